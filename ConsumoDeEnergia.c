@@ -1,14 +1,95 @@
+// Compilar: gcc ConsumoDeEnergia.c -o ConsumoDeEnergia -lm -lpthread
+// Com entrada .gz/.zst (sem as flags, arquivos compactados são recusados com aviso):
+//   gcc -DCOM_ZLIB -DCOM_ZSTD ConsumoDeEnergia.c -o ConsumoDeEnergia -lm -lpthread -lz -lzstd
 #include <stdio.h>
+#include <stdint.h> // Para os tipos do armazenamento compacto
+#include <stddef.h> // Para offsetof
 #include <stdlib.h> // Para malloc, free, exit, strtod
 #include <string.h> // Para strtok, strcpy
 #include <math.h>   // Para sqrt, fabs, isnan
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 #include <locale.h> // Para setlocale (ler vírgulas corretamente)
+#include <pthread.h> // Para simular cenários em paralelo
+
+#ifndef _WIN32
+#include <poll.h>       // Para poll (modo servidor)
+#include <unistd.h>     // Para read, close, unlink
+#include <sys/socket.h> // Para socket, bind, accept
+#include <sys/stat.h>   // Para stat (observar o arquivo)
+#include <sys/un.h>     // Para sockaddr_un
+#include <signal.h>     // Para bloquear SIGPIPE na thread de descompressão
+#include <errno.h>      // Para EINTR
+#else
+#include <windows.h>    // Para GetSystemInfo (número de núcleos)
+#endif
+
+#ifdef COM_ZLIB
+#include <zlib.h>       // Para inflate (entrada .gz)
+#endif
+#ifdef COM_ZSTD
+#include <zstd.h>       // Para ZSTD_decompressStream (entrada .zst)
+#endif
+#if !defined(_WIN32) && (defined(COM_ZLIB) || defined(COM_ZSTD))
+#define DESCOMPRESSAO_EM_THREAD
+#endif
 
 // Constantes
 #define MAX_DIAS 400     // Tamanho máximo do vetor
 #define MAX_LINHA 1024   // Tamanho máximo de uma linha do CSV
+#define MAX_COLUNAS 64   // Colunas máximas no cabeçalho do CSV
 #define JANELA_OUTLIER 2 // Janela de ±2 dias para mediana do outlier
 #define Z_SCORE_LIMITE 3.0 // Limite Z-score para outliers
+#define JANELA_MM3 3     // Dias usados na previsao por media movel
+
+// Modo fluxo: so guarda a maior janela usada (outlier ±2 ou MM3)
+#define JANELA_FLUXO ((2 * JANELA_OUTLIER + 1) > JANELA_MM3 ? (2 * JANELA_OUTLIER + 1) : JANELA_MM3)
+#define MIN_AMOSTRAS_FLUXO 30 // Dias minimos antes de marcar outliers no fluxo
+
+// Modo servidor
+#define MAX_CLIENTES 16              // Conexões simultâneas no socket
+#define INTERVALO_OBSERVACAO_MS 500  // Intervalo para verificar novas linhas no arquivo
+
+// Custos
+#define MAX_PERIODOS (MAX_DIAS / 28 + 2) // Meses distintos cabíveis em MAX_DIAS
+
+// Simulador
+#define MAX_THREADS 64   // Limite de threads na varredura de cenários
+#define JANELA_VE 3      // Dias que a recarga do VE pode ser adiada
+#define TOP_CENARIOS 10  // Cenários exibidos no resumo
+#define CAPACIDADE_MAX 30000.0  // Maior bateria da varredura (kWh)
+#define PASSO_CAPACIDADE 500.0  // Passo da varredura de capacidade (kWh)
+
+// Reduções determinísticas
+#define BLOCO_REDUCAO 64      // Elementos por bloco (forma fixa da soma)
+
+// Correlação defasada
+#define DEFASAGEM_PADRAO 14   // Defasagens usadas por "--only defasagem" sem --defasagem
+
+// Quantis (esboço KLL)
+#define KLL_K 200              // Itens por nível do esboço de quantis (par)
+#define KLL_NIVEIS 32          // Níveis: comporta ~KLL_K * 2^31 leituras
+
+// Entrada compactada
+#define BLOCO_DESCOMPRESSAO 65536 // Bytes por bloco entre a descompressão e o parser
+
+// Frota
+#define Z_ROBUSTO_LIMITE 3.5   // |z| robusto (mediana/MAD) acima do qual o medidor destoa da frota
+#define MIN_MEDIDORES_DIA 8    // Medidores mínimos num dia para comparar com os pares
+#define MAD_PISO_RELATIVO 1.0  // MAD do dia nunca abaixo do MAD típico da frota vezes este fator
+#define NUM_REGRESSORES 4      // Modelo da frota: 1, temp, ocupacao, diaUtil
+#define TOP_ANOMALIAS 10       // Anomalias listadas no relatório da frota
+
+// Armazenamento compacto: escalas dos inteiros e bits de flags
+#define ESCALA_DECIMO 10.0
+#define ESCALA_CENTESIMO 100.0
+#define ESCALA_MILESIMO 1000.0
+#define FLAG_DIA_UTIL 0x01
+#define FLAG_FERIADO  0x02
+#define FLAG_OUTLIER  0x04
+#define EPOCA_COMPACTA 10957L  // 2000-01-01 em dias desde 1970-01-01
+#define DATA_AUSENTE 0xFFFF    // Dia sem data no layout compacto
 
 // Estrutura para armazenar os dados de um dia
 typedef struct {
@@ -32,235 +113,2994 @@ typedef struct {
     double zscoreConsumo;
     int ehOutlier;
 
+    // Custos do dia (R$), calculados na análise
+    double custoRede;  // Importação paga à tarifa do dia
+    double custoVE;    // Parcela da importação atribuída à recarga do VE
+    double economiaFV; // Importação evitada pela geração FV
+
+    unsigned ausentes; // Bits (1u << CampoCSV) dos campos vazios/inválidos no CSV
+
 } RegistroEnergia;
 
+// Forma compacta de RegistroEnergia (40 bytes): inteiros escalados, float32
+// e flags em bits. Limites de erro documentados em compactarRegistro. Os campos
+// derivados (consumo líquido, custos) são recalculados ao decodificar.
+typedef struct {
+    float consumo;
+    float geracaoFV;
+    float cargaVE;
+    float importacaoRede;
+    float zscoreConsumo;
+    uint16_t dia;
+    uint16_t data;       // Dias desde 2000-01-01 (DATA_AUSENTE = sem data)
+    uint16_t ausentes;   // Mesmos bits de RegistroEnergia.ausentes
+    int16_t temp;        // °C x 10
+    int16_t umidade;     // % x 10
+    int16_t irradiancia; // kWh/m² x 100
+    int16_t vento;       // m/s x 10
+    int16_t ocupacao;    // % x 10
+    int16_t tarifaPonta; // R$/kWh x 1000
+    uint8_t flags;       // FLAG_DIA_UTIL | FLAG_FERIADO | FLAG_OUTLIER
+} RegistroCompacto;
+
+// Dados carregados, num dos dois layouts (o outro ponteiro fica NULL). Tudo
+// passa por lerDia/gravarDia, então a mesma análise serve aos dois.
+typedef struct {
+    RegistroEnergia* completo;
+    RegistroCompacto* compacto;
+    int n;
+    int saturados;     // Compacto: valores saturados na codificação
+    double erroMaximo; // Compacto: maior erro de codificação na leitura
+} TabelaDados;
+
+// Campos do esquema do CSV (a ordem das colunas vem do cabeçalho)
+typedef enum {
+    CAMPO_IGNORADO = -1,
+    CAMPO_DIA, CAMPO_DATA, CAMPO_TEMP, CAMPO_UMIDADE, CAMPO_IRRADIANCIA, CAMPO_VENTO,
+    CAMPO_OCUPACAO, CAMPO_DIA_UTIL, CAMPO_FERIADO, CAMPO_TARIFA, CAMPO_CONSUMO,
+    CAMPO_GERACAO_FV, CAMPO_CARGA_VE, CAMPO_IMPORTACAO,
+    NUM_CAMPOS
+} CampoCSV;
+
+// Plano de leitura: para cada coluna do arquivo, o campo de destino
+typedef struct {
+    int nColunas;
+    signed char campos[MAX_COLUNAS]; // CampoCSV ou CAMPO_IGNORADO
+    char separadorDecimal;           // Separador do locale atual (para strtod)
+} PlanoLeitura;
+
+// Formato do arquivo de entrada, detectado pelos primeiros bytes
+enum { FORMATO_TEXTO, FORMATO_GZIP, FORMATO_ZSTD };
+
+// Entrada do parser. Para arquivos compactados, uma thread descomprime bloco a
+// bloco e escreve num pipe; o parser lê a outra ponta (fp) como texto comum.
+typedef struct {
+    FILE* fp;                // De onde as linhas são lidas
+    FILE* origem;            // Arquivo aberto pelo chamador
+    int formato;
+    unsigned char prefixo[4]; // Bytes já consumidos na detecção
+    size_t nPrefixo;
+#ifndef _WIN32
+    int fdEscrita;           // Ponta de escrita do pipe
+    pthread_t thread;
+    int comThread;
+#endif
+    int erro;                // Falha na descompressão (arquivo corrompido/truncado)
+} Entrada;
+
+// Como preencher valores ausentes de uma coluna
+typedef enum {
+    IMPUTA_LINEAR,  // Interpolação entre os vizinhos válidos
+    IMPUTA_ULTIMO,  // Último valor válido
+    IMPUTA_MM3,     // Média móvel dos 3 dias anteriores
+    NUM_METODOS_IMPUTACAO
+} MetodoImputacao;
+
+// Coluna numérica do registro (para varrer as colunas de forma genérica)
+typedef struct {
+    const char* nome;
+    int campo;     // CampoCSV
+    size_t offset; // Posição no RegistroEnergia
+    int inteiro;   // 1 = campo int, 0 = double
+    double (*compacto)(const RegistroCompacto* c); // Mesmo campo lido do layout compacto
+} ColunaNumerica;
+
+// Totais de custo de um período (mês "YYYY-MM")
+typedef struct {
+    char periodo[8];
+    int dias;
+    double importacao;
+    double custoRede;
+    double custoVE;
+    double economiaFV;
+} ResumoPeriodo;
+
+// Políticas de recarga do VE no simulador
+enum { VE_ORIGINAL, VE_EXCEDENTE_FV, VE_TARIFA_MENOR };
+
+// Um cenário do simulador: parâmetros e resultados
+typedef struct {
+    double capacidade;  // Bateria (kWh)
+    double eficiencia;  // Eficiência de ida e volta (0-1)
+    double escalaFV;    // Multiplicador da geração FV
+    int politicaVE;     // VE_ORIGINAL, VE_EXCEDENTE_FV ou VE_TARIFA_MENOR
+
+    double importacao;  // kWh importados no período
+    double autoconsumo; // Fração da geração FV usada localmente
+    double custo;       // R$ da importação
+} CenarioSimulacao;
+
+// Soma com compensação de erro (Neumaier)
+typedef struct {
+    double soma;
+    double compensacao;
+} SomaCompensada;
+
+// Momentos centrados para correlação/regressão incremental (Welford)
+typedef struct {
+    long n;
+    double mediaX, mediaY;
+    double m2X, m2Y, coMomento;
+} AcumuladorCorrelacao;
+
+// Esboço de quantis mesclável (compactadores do KLL, mesma capacidade em todo
+// nível). Um item no nível h representa 2^h leituras; memória fixa, sem ordenar
+// nem guardar a série, e dois esboços se combinam em um só (threads, medidores).
+typedef struct {
+    double itens[KLL_NIVEIS][KLL_K];
+    int tamanho[KLL_NIVEIS];
+    unsigned compactacoes[KLL_NIVEIS]; // A paridade alterna a metade mantida
+    int niveis;                        // Níveis em uso
+    long long n;
+    double min, max;
+} EsbocoQuantis;
+
+// Estado do modo fluxo: memória limitada pela janela, não pelo tamanho da entrada
+typedef struct {
+    RegistroEnergia janela[JANELA_FLUXO]; // Buffer circular com os últimos dias
+    long lidos;    // Linhas válidas recebidas
+    long emitidos; // Linhas já tratadas e emitidas
+
+    // Média/variância correntes do consumo bruto (Welford) para o Z-score
+    double mediaBruta, m2Bruta;
+
+    // Estatísticas do consumo tratado
+    double minCons, maxCons;
+    double minFV, maxFV;
+    double minImp, maxImp;
+    SomaCompensada somaCons, somaFV, somaImp;
+    SomaCompensada somaUtil, somaFDS;
+    long nUtil, nFDS;
+    int outliers;
+    SomaCompensada somaCustoRede, somaCustoVE, somaEconomiaFV;
+
+    AcumuladorCorrelacao corrTemp, corrUmidade, corrOcupacao, corrIrradiancia;
+    AcumuladorCorrelacao regressao; // Consumo ~ Irradiância
+    EsbocoQuantis quantisCons, quantisImp;
+
+    // Consumo tratado dos JANELA_MM3 últimos dias emitidos (circular), para o
+    // Prev_MM3 seguir a mesma regra de exportarCSV
+    double ultimosTratados[JANELA_MM3];
+} EstadoFluxo;
+
+// Intermediários dos dados tratados, calculados uma vez e reusados pelas etapas
+typedef struct {
+    double mediaConsumo, mediaGeracaoFV, mediaImportacao, mediaIrradiancia;
+    double somaQuadConsumo;             // soma (consumo - média)^2
+    double somaQuadIrradiancia;         // soma (irr - média)^2
+    double somaCruzadaIrradianciaConsumo; // soma (irr - média)(consumo - média)
+} Momentos;
+
+// Regressão Consumo ~ Irradiância
+typedef struct {
+    double b0, b1;
+    int valido;
+} ModeloLinear;
+
+// Um medidor (arquivo) na análise de frota
+typedef struct {
+    const char* arquivo;
+    RegistroEnergia* dados;
+    int n;
+    double mediana;  // Consumo mediano do próprio medidor (normalização)
+    double xtx[NUM_REGRESSORES][NUM_REGRESSORES]; // Parciais da regressão global
+    double xty[NUM_REGRESSORES];
+    int anomalias;
+    double percentisCons[3], percentisImp[3]; // P50/P95/P99 do próprio medidor
+    int semData, foraMatriz, repetidos; // Linhas que não entraram na matriz
+} MedidorFrota;
+
+// Matriz medidor x dia da frota. Coluna = dias desde a data mais antiga da
+// frota; NaN = sem leitura.
+typedef struct {
+    MedidorFrota* medidores;
+    int nMedidores;
+    long inicio; // Data da coluna 0 (dias desde 1970-01-01)
+    int nDias;
+    double beta[NUM_REGRESSORES];
+    double* residuos; // nMedidores x nDias
+    double* zRobusto; // nMedidores x nDias
+    double* medianaDia; // Mediana dos resíduos de cada dia
+    double* madDia;     // MAD de cada dia (NaN = poucos medidores)
+    double madTipico;   // Mediana dos MAD dos dias: piso contra dias com pares quase iguais
+    // Consumo/importação: medidor m entra nos esboços m % nGrupos. Os grupos não
+    // dependem do número de threads, então os percentis combinados também não.
+    EsbocoQuantis quantisCons[MAX_THREADS], quantisImp[MAX_THREADS];
+    int nGrupos;
+} Frota;
+
+// Etapas do pipeline (ordem de execução quando várias são pedidas)
+typedef enum {
+    ETAPA_LEITURA, ETAPA_IMPUTACAO, ETAPA_TRATAMENTO, ETAPA_MOMENTOS, ETAPA_REGRESSAO,
+    ETAPA_ESTATISTICAS, ETAPA_DEFASAGEM, ETAPA_PREVISAO, ETAPA_EXPORTACAO,
+    ETAPA_SIMULACAO,
+    NUM_ETAPAS
+} Etapa;
+
+typedef struct {
+    const char* arquivo;
+    int nThreads;
+    int maxDefasagem;
+    MetodoImputacao imputacao;
+    int compacto; // Guarda os dias como RegistroCompacto
+
+    TabelaDados tabela;
+    Momentos momentos;
+    ModeloLinear modelo;
+
+    int concluida[NUM_ETAPAS];
+    int erro;
+} Pipeline;
+
+typedef struct {
+    const char* nome;      // Nome aceito em --only
+    const char* apelido;   // Nome alternativo (inglês)
+    unsigned dependencias; // Bits das etapas que precisam rodar antes
+    void (*executar)(Pipeline* p);
+} DefinicaoEtapa;
+
 // --- Protótipos ---
+int montarPlano(const char* cabecalho, PlanoLeitura* plano, FILE* saidaErros);
+int interpretarLinha(const PlanoLeitura* plano, const char* linha, RegistroEnergia* reg);
+int abrirEntrada(Entrada* e, FILE* origem);
+char* lerLinhaEntrada(Entrada* e, char* linha, int tam);
+int fecharEntrada(Entrada* e);
+int lerTabela(const char* nomeArquivo, TabelaDados* tabela, int maxRegistros);
 int lerCSV(const char* nomeArquivo, RegistroEnergia dados[], int maxRegistros);
-void tratarDados(RegistroEnergia dados[], int n);
-void analisarDados(RegistroEnergia dados[], int n);
-void preverConsumo(RegistroEnergia dados[], int n);
+void lerDia(const TabelaDados* t, int i, RegistroEnergia* reg);
+void gravarDia(TabelaDados* t, int i, const RegistroEnergia* reg);
+int converterData(const char* texto, long* dias);
+void formatarData(long dias, char saida[11]);
+int imputarColuna(double v[], int n, MetodoImputacao metodo);
+int imputarDados(TabelaDados* t, MetodoImputacao metodo, int contagem[NUM_CAMPOS]);
+void tratarDados(TabelaDados* t);
+int correlacaoDefasada(const double* x, const double* y, int n, int maxDefasagem, double* saida);
+void analisarDefasagens(const TabelaDados* t, int maxDefasagem);
+void calcularCustos(RegistroEnergia* reg);
+void calcularMomentos(const TabelaDados* t, Momentos* m);
+void ajustarModelo(const Momentos* m, ModeloLinear* modelo);
+void analisarDados(const TabelaDados* t, const Momentos* m);
+void preverConsumo(const TabelaDados* t, const ModeloLinear* modelo);
+void exportarCSV(const char* nomeArquivo, const TabelaDados* t, const ModeloLinear* modelo);
+void somarCompensado(SomaCompensada* s, double v);
+double totalCompensado(const SomaCompensada* s);
+double reduzirSoma(const double* v, int n);
+void iniciarQuantis(EsbocoQuantis* q);
+void inserirQuantil(EsbocoQuantis* q, double v);
+void combinarQuantis(EsbocoQuantis* destino, const EsbocoQuantis* origem);
+int calcularQuantis(const EsbocoQuantis* q, const double p[], int np, double saida[]);
+int extrairColuna(const TabelaDados* t, const char* nome, double* saida);
+int numeroNucleos(void);
+void acumularCorrelacao(AcumuladorCorrelacao* acc, double x, double y);
+double correlacaoAcumulada(const AcumuladorCorrelacao* acc);
+int processarFluxo(FILE* fp);
+int executarServidor(const char* arquivo, const char* caminhoSocket);
+void simularCenarios(const RegistroEnergia dados[], int n, int nThreads, const char* arquivoSaida);
+double medianaVetor(double v[], int n);
+int analisarFrota(char* arquivos[], int nArquivos, int nThreads);
+int compactarRegistro(const RegistroEnergia* reg, RegistroCompacto* c);
+void descompactarRegistro(const RegistroCompacto* c, RegistroEnergia* reg);
+double erroCompactacao(const RegistroEnergia* original, const RegistroEnergia* decodificado);
 
 // --- Função de Leitura ---
-int lerCSV(const char* nomeArquivo, RegistroEnergia dados[], int maxRegistros) {
-    FILE* fp = fopen(nomeArquivo, "r");
-    if (fp == NULL) {
-        return -1;
+// Nomes do esquema já normalizados (sem acento, unidade, espaços; minúsculos)
+static const char* NOMES_CAMPOS[NUM_CAMPOS] = {
+    "dia", "data", "temp", "umidade", "irradiancia", "vento", "ocupacao",
+    "diautil", "feriado", "tarifaponta", "consumo", "geracaofv", "cargave", "importacaorede"
+};
+
+// Letra base (ASCII) para Latin-1 0xC0-0xFF; 0 = descartar
+static const char BASE_LATIN1[64] =
+    "AAAAAAACEEEEIIIIDNOOOOO\0OUUUUY\0s"
+    "aaaaaaaceeeeiiiidnooooo\0ouuuuy\0y";
+
+// Normaliza um nome de coluna: corta a unidade " (...)", remove acentos
+// (UTF-8 ou Latin-1), espaços e pontuação, e passa para minúsculas.
+static void normalizarNomeColuna(const char* ini, const char* fim, char* saida, size_t tam) {
+    size_t k = 0;
+    const unsigned char* p = (const unsigned char*)ini;
+    const unsigned char* f = (const unsigned char*)fim;
+
+    while (p < f && k + 1 < tam) {
+        unsigned char c = *p++;
+        if (c == '(') break; // Unidade: "Temp (°C)"
+        if (c == 0xC3 && p < f && *p >= 0x80 && *p <= 0xBF) {
+            c = (unsigned char)BASE_LATIN1[*p++ - 0x80]; // UTF-8 de U+00C0..U+00FF
+        } else if (c >= 0xC0) {
+            c = (unsigned char)BASE_LATIN1[c - 0xC0];    // Latin-1 (exportação do Excel)
+        } else if (c >= 0x80) {
+            continue;                                    // Outros bytes (ex.: BOM, °, ²)
+        }
+        if (c >= 'A' && c <= 'Z') c = (unsigned char)(c - 'A' + 'a');
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) saida[k++] = (char)c;
     }
+    saida[k] = '\0';
+}
 
-    char linha[MAX_LINHA];
-    int n = 0;
+// Casa o cabeçalho com o esquema uma única vez e monta o plano coluna -> campo.
+// Retorna 1 se todos os campos do esquema foram encontrados; as colunas ausentes
+// vão para 'saidaErros' (stderr no modo fluxo, onde stdout é só o CSV).
+int montarPlano(const char* cabecalho, PlanoLeitura* plano, FILE* saidaErros) {
+    int encontrado[NUM_CAMPOS] = {0};
+    const char* p = cabecalho;
 
-    // Pular cabeçalho
-    if (fgets(linha, MAX_LINHA, fp) == NULL) {
-        fclose(fp);
-        return 0;
+    memset(plano, 0, sizeof(*plano));
+    plano->separadorDecimal = localeconv()->decimal_point[0];
+
+    // Pular BOM UTF-8
+    if (strncmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+
+    while (plano->nColunas < MAX_COLUNAS) {
+        const char* fim = p + strcspn(p, ";\r\n");
+        char nome[64];
+        CampoCSV campo = CAMPO_IGNORADO;
+
+        normalizarNomeColuna(p, fim, nome, sizeof(nome));
+        for (int c = 0; c < NUM_CAMPOS; c++) {
+            if (!encontrado[c] && strcmp(nome, NOMES_CAMPOS[c]) == 0) {
+                campo = (CampoCSV)c;
+                encontrado[c] = 1;
+                break;
+            }
+        }
+        plano->campos[plano->nColunas++] = (signed char)campo;
+
+        if (*fim != ';') break;
+        p = fim + 1;
     }
 
-    // Ler dados (usando ; como separador)
-    while (n < maxRegistros && fgets(linha, MAX_LINHA, fp) != NULL) {
-        // Formato: Dia;Data;Temp;...
-        int camposLidos = sscanf(linha, "%d;%*[^;];%lf;%lf;%lf;%lf;%lf;%d;%d;%lf;%lf;%lf;%lf;%lf",
-               &dados[n].dia, &dados[n].temp, &dados[n].umidade,
-               &dados[n].irradiancia, &dados[n].vento, &dados[n].ocupacao,
-               &dados[n].diaUtil, &dados[n].feriado, &dados[n].tarifaPonta,
-               &dados[n].consumo, &dados[n].geracaoFV, &dados[n].cargaVE,
-               &dados[n].importacaoRede);
-        
-        if (camposLidos == 13) {
-            n++;
+    int completo = 1;
+    for (int c = 0; c < NUM_CAMPOS; c++) {
+        if (!encontrado[c]) {
+            fprintf(saidaErros, "Coluna obrigatoria ausente no cabecalho: %s\n", NOMES_CAMPOS[c]);
+            completo = 0;
         }
     }
+    return completo;
+}
 
-    fclose(fp);
-    return n;
+// Converte um campo numérico aceitando vírgula ou ponto, independente do locale
+static int lerNumero(const char* ini, const char* fim, char separadorDecimal, double* valor) {
+    char buffer[64];
+    size_t len = (size_t)(fim - ini);
+    if (len == 0 || len >= sizeof(buffer)) return 0;
+
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = (ini[i] == ',' || ini[i] == '.') ? separadorDecimal : ini[i];
+    }
+    buffer[len] = '\0';
+
+    char* resto;
+    *valor = strtod(buffer, &resto);
+    while (*resto == ' ') resto++;
+    return resto != buffer && *resto == '\0';
 }
 
-// --- Funções Auxiliares de Tratamento ---
-double medianaJanela(RegistroEnergia dados[], int indice, int n) {
-    double soma = 0;
-    int count = 0;
-    for (int i = indice - JANELA_OUTLIER; i <= indice + JANELA_OUTLIER; i++) {
-        if (i >= 0 && i < n && !dados[i].ehOutlier) {
-            soma += dados[i].consumo;
-            count++;
+// Decodificadores por campo do layout compacto: uma varredura de coluna lê só
+// o campo pedido, sem formatar a data nem recalcular os custos do dia
+static inline double decTemp(const RegistroCompacto* c)        { return c->temp / ESCALA_DECIMO; }
+static inline double decUmidade(const RegistroCompacto* c)     { return c->umidade / ESCALA_DECIMO; }
+static inline double decIrradiancia(const RegistroCompacto* c) { return c->irradiancia / ESCALA_CENTESIMO; }
+static inline double decVento(const RegistroCompacto* c)       { return c->vento / ESCALA_DECIMO; }
+static inline double decOcupacao(const RegistroCompacto* c)    { return c->ocupacao / ESCALA_DECIMO; }
+static inline double decTarifa(const RegistroCompacto* c)      { return c->tarifaPonta / ESCALA_MILESIMO; }
+
+static inline double decDia(const RegistroCompacto* c)         { return c->dia; }
+static inline double decDiaUtil(const RegistroCompacto* c)     { return (c->flags & FLAG_DIA_UTIL) != 0; }
+static inline double decFeriado(const RegistroCompacto* c)     { return (c->flags & FLAG_FERIADO) != 0; }
+static inline double decConsumo(const RegistroCompacto* c)     { return c->consumo; }
+static inline double decGeracaoFV(const RegistroCompacto* c)   { return c->geracaoFV; }
+static inline double decCargaVE(const RegistroCompacto* c)     { return c->cargaVE; }
+static inline double decImportacao(const RegistroCompacto* c)  { return c->importacaoRede; }
+static inline double decZscore(const RegistroCompacto* c)      { return c->zscoreConsumo; }
+static inline double decConsumoLiquido(const RegistroCompacto* c) { return (double)c->consumo - c->geracaoFV; }
+
+// Custos: só os cinco campos de que calcularCustos precisa
+static RegistroEnergia custosCompacto(const RegistroCompacto* c) {
+    RegistroEnergia reg;
+    reg.consumo = c->consumo;
+    reg.geracaoFV = c->geracaoFV;
+    reg.cargaVE = c->cargaVE;
+    reg.importacaoRede = c->importacaoRede;
+    reg.tarifaPonta = decTarifa(c);
+    calcularCustos(&reg);
+    return reg;
+}
+static double decCustoRede(const RegistroCompacto* c)  { return custosCompacto(c).custoRede; }
+static double decCustoVE(const RegistroCompacto* c)    { return custosCompacto(c).custoVE; }
+static double decEconomiaFV(const RegistroCompacto* c) { return custosCompacto(c).economiaFV; }
+
+static const ColunaNumerica COLUNAS_NUMERICAS[] = {
+    {"dia",            CAMPO_DIA,         offsetof(RegistroEnergia, dia),            1, decDia},
+    {"temp",           CAMPO_TEMP,        offsetof(RegistroEnergia, temp),           0, decTemp},
+    {"umidade",        CAMPO_UMIDADE,     offsetof(RegistroEnergia, umidade),        0, decUmidade},
+    {"irradiancia",    CAMPO_IRRADIANCIA, offsetof(RegistroEnergia, irradiancia),    0, decIrradiancia},
+    {"vento",          CAMPO_VENTO,       offsetof(RegistroEnergia, vento),          0, decVento},
+    {"ocupacao",       CAMPO_OCUPACAO,    offsetof(RegistroEnergia, ocupacao),       0, decOcupacao},
+    {"diaUtil",        CAMPO_DIA_UTIL,    offsetof(RegistroEnergia, diaUtil),        1, decDiaUtil},
+    {"feriado",        CAMPO_FERIADO,     offsetof(RegistroEnergia, feriado),        1, decFeriado},
+    {"tarifaPonta",    CAMPO_TARIFA,      offsetof(RegistroEnergia, tarifaPonta),    0, decTarifa},
+    {"consumo",        CAMPO_CONSUMO,     offsetof(RegistroEnergia, consumo),        0, decConsumo},
+    {"geracaoFV",      CAMPO_GERACAO_FV,  offsetof(RegistroEnergia, geracaoFV),      0, decGeracaoFV},
+    {"cargaVE",        CAMPO_CARGA_VE,    offsetof(RegistroEnergia, cargaVE),        0, decCargaVE},
+    {"importacaoRede", CAMPO_IMPORTACAO,  offsetof(RegistroEnergia, importacaoRede), 0, decImportacao},
+};
+#define NUM_COLUNAS_NUMERICAS ((int)(sizeof(COLUNAS_NUMERICAS) / sizeof(COLUNAS_NUMERICAS[0])))
+
+// Colunas calculadas no tratamento (não vêm do CSV, por isso sem campo)
+static const ColunaNumerica COLUNAS_DERIVADAS[] = {
+    {"zscoreConsumo",  -1, offsetof(RegistroEnergia, zscoreConsumo),  0, decZscore},
+    {"consumoLiquido", -1, offsetof(RegistroEnergia, consumoLiquido), 0, decConsumoLiquido},
+    {"custoRede",      -1, offsetof(RegistroEnergia, custoRede),      0, decCustoRede},
+    {"custoVE",        -1, offsetof(RegistroEnergia, custoVE),        0, decCustoVE},
+    {"economiaFV",     -1, offsetof(RegistroEnergia, economiaFV),     0, decEconomiaFV},
+};
+#define NUM_COLUNAS_DERIVADAS ((int)(sizeof(COLUNAS_DERIVADAS) / sizeof(COLUNAS_DERIVADAS[0])))
+
+// Coluna pelo nome (lidas do CSV ou derivadas). NULL se não existir.
+static const ColunaNumerica* buscarColuna(const char* nome) {
+    for (int c = 0; c < NUM_COLUNAS_NUMERICAS; c++) {
+        if (strcmp(COLUNAS_NUMERICAS[c].nome, nome) == 0) return &COLUNAS_NUMERICAS[c];
+    }
+    for (int c = 0; c < NUM_COLUNAS_DERIVADAS; c++) {
+        if (strcmp(COLUNAS_DERIVADAS[c].nome, nome) == 0) return &COLUNAS_DERIVADAS[c];
+    }
+    return NULL;
+}
+
+static double lerColuna(const RegistroEnergia* reg, const ColunaNumerica* c) {
+    const char* base = (const char*)reg + c->offset;
+    return c->inteiro ? (double)*(const int*)base : *(const double*)base;
+}
+
+// Campos int não têm NaN: ficam 0 e só o bit em 'ausentes' marca a falta
+static void gravarColuna(RegistroEnergia* reg, const ColunaNumerica* c, double v) {
+    char* base = (char*)reg + c->offset;
+    if (c->inteiro) *(int*)base = isnan(v) ? 0 : (int)lround(v);
+    else *(double*)base = v;
+}
+
+// Interpreta uma linha de dados seguindo o plano. Células vazias ou inválidas
+// (e colunas que faltam no fim da linha) viram NaN e ficam marcadas em
+// reg->ausentes para a etapa de imputação. Retorna 1 se ao menos um valor
+// numérico foi lido.
+int interpretarLinha(const PlanoLeitura* plano, const char* linha, RegistroEnergia* reg) {
+    const char* p = linha;
+    int lidos = 0;
+
+    memset(reg, 0, sizeof(*reg));
+    reg->ausentes = (1u << NUM_CAMPOS) - 1;
+
+    for (int col = 0; col < plano->nColunas; col++) {
+        const char* fim = p + strcspn(p, ";\r\n");
+        int campo = plano->campos[col];
+        double v = 0;
+
+        if (campo == CAMPO_DATA) {
+            size_t len = (size_t)(fim - p);
+            if (len >= sizeof(reg->data)) len = sizeof(reg->data) - 1;
+            memcpy(reg->data, p, len);
+            reg->data[len] = '\0';
+            if (len > 0) reg->ausentes &= ~(1u << CAMPO_DATA);
+        } else if (campo != CAMPO_IGNORADO && lerNumero(p, fim, plano->separadorDecimal, &v)) {
+            switch (campo) {
+                case CAMPO_DIA:         reg->dia = (int)v; break;
+                case CAMPO_TEMP:        reg->temp = v; break;
+                case CAMPO_UMIDADE:     reg->umidade = v; break;
+                case CAMPO_IRRADIANCIA: reg->irradiancia = v; break;
+                case CAMPO_VENTO:       reg->vento = v; break;
+                case CAMPO_OCUPACAO:    reg->ocupacao = v; break;
+                case CAMPO_DIA_UTIL:    reg->diaUtil = (int)v; break;
+                case CAMPO_FERIADO:     reg->feriado = (int)v; break;
+                case CAMPO_TARIFA:      reg->tarifaPonta = v; break;
+                case CAMPO_CONSUMO:     reg->consumo = v; break;
+                case CAMPO_GERACAO_FV:  reg->geracaoFV = v; break;
+                case CAMPO_CARGA_VE:    reg->cargaVE = v; break;
+                case CAMPO_IMPORTACAO:  reg->importacaoRede = v; break;
+                default: break;
+            }
+            reg->ausentes &= ~(1u << campo);
+            lidos++;
+        }
+
+        if (*fim != ';') break;
+        p = fim + 1;
+    }
+
+    if (reg->ausentes != 0) {
+        for (int c = 0; c < NUM_COLUNAS_NUMERICAS; c++) {
+            if (reg->ausentes & (1u << COLUNAS_NUMERICAS[c].campo)) gravarColuna(reg, &COLUNAS_NUMERICAS[c], NAN);
         }
     }
-    return (count > 0) ? (soma / count) : dados[indice].consumo;
+
+    return lidos > 0;
 }
 
-// --- Função de Tratamento ---
-void tratarDados(RegistroEnergia dados[], int n) {
-    // 1. Tratar Negativos
-    for (int i = 0; i < n; i++) {
-        if (dados[i].consumo < 0) dados[i].consumo = (i > 0) ? dados[i-1].consumo : 0;
-        if (dados[i].geracaoFV < 0) dados[i].geracaoFV = (i > 0) ? dados[i-1].geracaoFV : 0;
+// --- Entrada Compactada (gzip / zstd) ---
+static const char* NOMES_FORMATO[] = {"texto", "gzip", "zstd"};
+
+static int detectarFormato(const unsigned char* b, size_t n) {
+    if (n >= 2 && b[0] == 0x1f && b[1] == 0x8b) return FORMATO_GZIP;
+    if (n >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd) return FORMATO_ZSTD;
+    return FORMATO_TEXTO;
+}
+
+#ifdef DESCOMPRESSAO_EM_THREAD
+// Lê da origem, devolvendo antes os bytes consumidos pela detecção
+static size_t lerOrigem(Entrada* e, unsigned char* buffer, size_t tam) {
+    size_t k = 0;
+    while (e->nPrefixo > 0 && k < tam) {
+        buffer[k++] = e->prefixo[0];
+        memmove(e->prefixo, e->prefixo + 1, --e->nPrefixo);
     }
+    return k + fread(buffer + k, 1, tam - k, e->origem);
+}
 
-    // 2. Tratar Outliers (Z-Score > 3)
-    if (n == 0) return;
+// Retorna 0 se o parser fechou a leitura (parou antes do fim) ou houve erro
+static int escreverBloco(int fd, const unsigned char* buffer, size_t n) {
+    while (n > 0) {
+        ssize_t escritos = write(fd, buffer, n);
+        if (escritos < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buffer += escritos;
+        n -= (size_t)escritos;
+    }
+    return 1;
+}
 
-    double somaConsumo = 0;
-    for (int i = 0; i < n; i++) somaConsumo += dados[i].consumo;
-    double mediaConsumo = somaConsumo / n;
+#ifdef COM_ZLIB
+// Aceita membros gzip concatenados (ex.: cat a.gz b.gz)
+static int descomprimirGzip(Entrada* e) {
+    unsigned char entrada[BLOCO_DESCOMPRESSAO], saida[BLOCO_DESCOMPRESSAO];
+    z_stream z;
+    int fimMembro = 0;
 
-    double somaQuadConsumo = 0;
-    for (int i = 0; i < n; i++) somaQuadConsumo += pow(dados[i].consumo - mediaConsumo, 2);
-    double stdDevConsumo = sqrt(somaQuadConsumo / n);
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 16) != Z_OK) return 0;
 
-    printf("\n--- Tratamento de Outliers ---\n");
-    printf("Media: %.2f, Desvio Padrao: %.2f\n", mediaConsumo, stdDevConsumo);
+    for (;;) {
+        if (z.avail_in == 0) {
+            size_t lidos = lerOrigem(e, entrada, sizeof(entrada));
+            if (lidos == 0) break;
+            z.next_in = entrada;
+            z.avail_in = (uInt)lidos;
+        }
+        if (fimMembro) {
+            inflateReset(&z);
+            fimMembro = 0;
+        }
 
-    if (stdDevConsumo > 0) {
-        for (int i = 0; i < n; i++) {
-            dados[i].zscoreConsumo = (dados[i].consumo - mediaConsumo) / stdDevConsumo;
-            dados[i].ehOutlier = (fabs(dados[i].zscoreConsumo) > Z_SCORE_LIMITE);
-            
-            if (dados[i].ehOutlier) {
-                printf("Outlier Dia %d: %.2f (Z=%.2f). Corrigindo...\n", dados[i].dia, dados[i].consumo, dados[i].zscoreConsumo);
-                dados[i].consumo = medianaJanela(dados, i, n);
-            }
+        z.next_out = saida;
+        z.avail_out = sizeof(saida);
+        int ret = inflate(&z, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) break;
+        if (!escreverBloco(e->fdEscrita, saida, sizeof(saida) - z.avail_out)) {
+            fimMembro = 1; // Leitor encerrou: não é erro
+            break;
         }
+        fimMembro = (ret == Z_STREAM_END);
     }
+
+    inflateEnd(&z);
+    return fimMembro;
 }
+#endif
 
-// --- Função Auxiliar de Correlação ---
-double calcularCorrelacao(RegistroEnergia dados[], int n, const char* var1, const char* var2) {
-    double somaX = 0, somaY = 0, somaXY = 0, somaX2 = 0, somaY2 = 0;
-    
-    for (int i = 0; i < n; i++) {
-        double x, y;
-        if (strcmp(var1, "consumo") == 0) x = dados[i].consumo;
-        else if (strcmp(var1, "temp") == 0) x = dados[i].temp;
-        // ... adicionar outros se necessário para x
-        
-        if (strcmp(var2, "consumo") == 0) y = dados[i].consumo;
-        else if (strcmp(var2, "temp") == 0) y = dados[i].temp;
-        else if (strcmp(var2, "umidade") == 0) y = dados[i].umidade;
-        else if (strcmp(var2, "ocupacao") == 0) y = dados[i].ocupacao;
-        else if (strcmp(var2, "irradiancia") == 0) y = dados[i].irradiancia;
-        else if (strcmp(var2, "diaUtil") == 0) y = (double)dados[i].diaUtil;
-
-        somaX += x; somaY += y; somaXY += x * y; somaX2 += x * x; somaY2 += y * y;
-    }
-    double numerador = (n * somaXY) - (somaX * somaY);
-    double denominador = sqrt(((n * somaX2) - pow(somaX, 2)) * ((n * somaY2) - pow(somaY, 2)));
-    return (denominador == 0) ? 0 : numerador / denominador;
+#ifdef COM_ZSTD
+// Aceita quadros concatenados (ex.: cat a.zst b.zst)
+static int descomprimirZstd(Entrada* e) {
+    size_t tamEntrada = ZSTD_DStreamInSize(), tamSaida = ZSTD_DStreamOutSize();
+    unsigned char* entrada = (unsigned char*)malloc(tamEntrada);
+    unsigned char* saida = (unsigned char*)malloc(tamSaida);
+    ZSTD_DCtx* ctx = ZSTD_createDCtx();
+    size_t ret = 1, lidos;
+    int ok = (entrada != NULL && saida != NULL && ctx != NULL);
+
+    while (ok && (lidos = lerOrigem(e, entrada, tamEntrada)) > 0) {
+        ZSTD_inBuffer in = {entrada, lidos, 0};
+        while (in.pos < in.size) {
+            ZSTD_outBuffer out = {saida, tamSaida, 0};
+            ret = ZSTD_decompressStream(ctx, &out, &in);
+            if (ZSTD_isError(ret)) { ok = 0; break; }
+            if (!escreverBloco(e->fdEscrita, saida, out.pos)) { ret = 0; goto fim; } // Leitor encerrou
+        }
+    }
+
+fim:
+    ZSTD_freeDCtx(ctx);
+    free(entrada);
+    free(saida);
+    return ok && ret == 0; // ret == 0: último quadro completo
 }
+#endif
 
-// --- Função de Análise (CORRIGIDA) ---
-void analisarDados(RegistroEnergia dados[], int n) {
-    printf("\n--- Analise Estatistica ---\n");
+static void* trabalhadorDescompressao(void* arg) {
+    Entrada* e = (Entrada*)arg;
 
-    if (n == 0) return;
+    // Se o parser parar antes do fim, write() deve falhar com EPIPE em vez de matar o processo
+    sigset_t bloqueio;
+    sigemptyset(&bloqueio);
+    sigaddset(&bloqueio, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &bloqueio, NULL);
 
-    // Calcular Consumo Líquido
-    for (int i = 0; i < n; i++) {
-        dados[i].consumoLiquido = dados[i].consumo - dados[i].geracaoFV;
+    int ok = 0;
+#ifdef COM_ZLIB
+    if (e->formato == FORMATO_GZIP) ok = descomprimirGzip(e);
+#endif
+#ifdef COM_ZSTD
+    if (e->formato == FORMATO_ZSTD) ok = descomprimirZstd(e);
+#endif
+    e->erro = !ok;
+    close(e->fdEscrita);
+    return NULL;
+}
+#endif
+
+// Detecta o formato de 'origem' e prepara e->fp. Texto é lido direto;
+// compactado passa pela thread de descompressão, que trabalha enquanto o parser
+// consome os blocos anteriores. Retorna 0 se o formato não puder ser lido nesta
+// compilação.
+int abrirEntrada(Entrada* e, FILE* origem) {
+    memset(e, 0, sizeof(*e));
+    e->origem = origem;
+    e->nPrefixo = fread(e->prefixo, 1, sizeof(e->prefixo), origem);
+    e->formato = detectarFormato(e->prefixo, e->nPrefixo);
+
+    if (e->formato == FORMATO_TEXTO) {
+        // Arquivo comum volta ao início; num pipe o prefixo sai por lerLinhaEntrada
+        if (fseek(origem, 0, SEEK_SET) == 0) e->nPrefixo = 0;
+        e->fp = origem;
+        return 1;
     }
 
-    // Inicialização
-    double minCons = dados[0].consumo, maxCons = dados[0].consumo, somaCons = 0;
-    double minFV = dados[0].geracaoFV, maxFV = dados[0].geracaoFV, somaFV = 0;
-    double minImp = dados[0].importacaoRede, maxImp = dados[0].importacaoRede, somaImp = 0;
+#ifdef COM_ZLIB
+    int comZlib = 1;
+#else
+    int comZlib = 0;
+#endif
+#ifdef COM_ZSTD
+    int comZstd = 1;
+#else
+    int comZstd = 0;
+#endif
+    if ((e->formato == FORMATO_GZIP && !comZlib) || (e->formato == FORMATO_ZSTD && !comZstd)) {
+        printf("Entrada compactada (%s) nao suportada: compile com %s.\n", NOMES_FORMATO[e->formato],
+               e->formato == FORMATO_GZIP ? "-DCOM_ZLIB -lz" : "-DCOM_ZSTD -lzstd");
+        return 0;
+    }
 
-    for (int i = 0; i < n; i++) {
-        // Somas
-        somaCons += dados[i].consumo;
-        somaFV += dados[i].geracaoFV;
-        somaImp += dados[i].importacaoRede;
+#ifdef DESCOMPRESSAO_EM_THREAD
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    e->fp = fdopen(fds[0], "r");
+    if (e->fp == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+    e->fdEscrita = fds[1];
+    if (pthread_create(&e->thread, NULL, trabalhadorDescompressao, e) != 0) {
+        fclose(e->fp);
+        close(fds[1]);
+        return 0;
+    }
+    e->comThread = 1;
+    return 1;
+#else
+    printf("Entrada compactada nao suportada no Windows.\n");
+    return 0;
+#endif
+}
 
-        // Min/Max Consumo
-        if (dados[i].consumo < minCons) minCons = dados[i].consumo;
-        if (dados[i].consumo > maxCons) maxCons = dados[i].consumo;
+// Espera a thread de descompressão terminar; depois disso e->erro é definitivo
+static void aguardarDescompressao(Entrada* e) {
+#ifndef _WIN32
+    if (e->comThread) {
+        pthread_join(e->thread, NULL);
+        e->comThread = 0;
+    }
+#else
+    (void)e;
+#endif
+}
 
-        // Min/Max Geração FV (CORREÇÃO APLICADA AQUI)
-        if (dados[i].geracaoFV < minFV) minFV = dados[i].geracaoFV;
-        if (dados[i].geracaoFV > maxFV) maxFV = dados[i].geracaoFV;
+// fgets sobre a entrada. Em texto vindo de pipe, começa pelos bytes que a
+// detecção não devolveu (nos compactados eles pertencem à thread).
+char* lerLinhaEntrada(Entrada* e, char* linha, int tam) {
+    int k = 0;
+    while (e->formato == FORMATO_TEXTO && e->nPrefixo > 0 && k < tam - 1) {
+        char c = (char)e->prefixo[0];
+        memmove(e->prefixo, e->prefixo + 1, --e->nPrefixo);
+        linha[k++] = c;
+        if (c == '\n') break;
+    }
+    if (k > 0 && (linha[k-1] == '\n' || k == tam - 1)) {
+        linha[k] = '\0';
+        return linha;
+    }
+    if (fgets(linha + k, tam - k, e->fp) == NULL) {
+        if (k == 0) return NULL;
+        linha[k] = '\0';
+    }
 
-        // Min/Max Importação (CORREÇÃO APLICADA AQUI)
-        if (dados[i].importacaoRede < minImp) minImp = dados[i].importacaoRede;
-        if (dados[i].importacaoRede > maxImp) maxImp = dados[i].importacaoRede;
+    // Última linha de um compactado sem '\n': se a descompressão falhou, é uma
+    // linha cortada no meio e não vai para o parser
+    size_t len = strlen(linha);
+    if (e->formato != FORMATO_TEXTO && linha[len-1] != '\n' && (int)len < tam - 1) {
+        aguardarDescompressao(e);
+        if (e->erro) return NULL;
     }
+    return linha;
+}
 
-    printf("Estatisticas Descritivas (N=%d dias):\n", n);
-    printf("  Consumo (kWh):    Media=%.2f  Min=%.2f  Max=%.2f\n", somaCons/n, minCons, maxCons);
-    printf("  Geracao FV (kWh): Media=%.2f  Min=%.2f  Max=%.2f\n", somaFV/n, minFV, maxFV);
-    printf("  Importacao (kWh): Media=%.2f  Min=%.2f  Max=%.2f\n", somaImp/n, minImp, maxImp);
+// Encerra a leitura (não fecha 'origem'). Retorna 0 se a descompressão falhou.
+int fecharEntrada(Entrada* e) {
+    if (e->fp != NULL && e->fp != e->origem) {
+        fclose(e->fp); // Desbloqueia a thread se o parser parou antes do fim
+        aguardarDescompressao(e);
+        if (e->erro) printf("Aviso: entrada %s corrompida ou truncada.\n", NOMES_FORMATO[e->formato]);
+    }
+    e->fp = NULL;
+    return !e->erro;
+}
 
-    // Correlações
-    printf("\nCorrelacoes (vs Consumo):\n");
-    printf("  vs Temperatura: %.4f\n", calcularCorrelacao(dados, n, "consumo", "temp"));
-    printf("  vs Umidade:     %.4f\n", calcularCorrelacao(dados, n, "consumo", "umidade"));
-    printf("  vs Ocupacao:    %.4f\n", calcularCorrelacao(dados, n, "consumo", "ocupacao"));
-    printf("  vs Irradiancia: %.4f\n", calcularCorrelacao(dados, n, "consumo", "irradiancia"));
-    
-    // Comparação Dia Útil
-    double somaUtil = 0, somaFDS = 0;
-    int nUtil = 0, nFDS = 0;
-    for (int i=0; i<n; i++) {
-        if (dados[i].diaUtil == 1 && dados[i].feriado == 0) {
-            somaUtil += dados[i].consumo; nUtil++;
-        } else {
-            somaFDS += dados[i].consumo; nFDS++;
+// Lê o CSV para a tabela, no layout dela. No compacto cada linha é codificada
+// assim que lida: o vetor de RegistroEnergia nunca existe.
+int lerTabela(const char* nomeArquivo, TabelaDados* tabela, int maxRegistros) {
+    FILE* origem = fopen(nomeArquivo, "rb");
+    if (origem == NULL) {
+        return -1;
+    }
+
+    Entrada entrada;
+    if (!abrirEntrada(&entrada, origem)) {
+        fclose(origem);
+        return -1;
+    }
+
+    char linha[MAX_LINHA];
+    PlanoLeitura plano;
+    RegistroEnergia reg, decodificado;
+    int n = 0;
+
+    tabela->n = 0;
+    tabela->saturados = 0;
+    tabela->erroMaximo = 0;
+
+    // Cabeçalho: define a ordem das colunas
+    if (lerLinhaEntrada(&entrada, linha, MAX_LINHA) == NULL) {
+        fecharEntrada(&entrada);
+        fclose(origem);
+        return 0;
+    }
+    if (!montarPlano(linha, &plano, stdout)) {
+        fecharEntrada(&entrada);
+        fclose(origem);
+        return -1;
+    }
+
+    // Ler dados (usando ; como separador)
+    while (n < maxRegistros && lerLinhaEntrada(&entrada, linha, MAX_LINHA) != NULL) {
+        if (tabela->completo != NULL) {
+            if (interpretarLinha(&plano, linha, &tabela->completo[n])) n++;
+        } else if (interpretarLinha(&plano, linha, &reg)) {
+            tabela->saturados += compactarRegistro(&reg, &tabela->compacto[n]);
+            descompactarRegistro(&tabela->compacto[n], &decodificado);
+            tabela->erroMaximo = fmax(tabela->erroMaximo, erroCompactacao(&reg, &decodificado));
+            n++;
         }
     }
-    printf("\nMedia Consumo: Dia Util (%.2f) vs FDS/Feriado (%.2f)\n", 
-           (nUtil>0 ? somaUtil/nUtil : 0), (nFDS>0 ? somaFDS/nFDS : 0));
+
+    fecharEntrada(&entrada);
+    fclose(origem);
+    tabela->n = n;
+    return n;
 }
 
-// --- Função de Previsão ---
-void preverConsumo(RegistroEnergia dados[], int n) {
-    if (n < 3) {
-        printf("Dados insuficientes para previsao.\n");
-        return;
+int lerCSV(const char* nomeArquivo, RegistroEnergia dados[], int maxRegistros) {
+    TabelaDados tabela = {dados, NULL, 0, 0, 0};
+    return lerTabela(nomeArquivo, &tabela, maxRegistros);
+}
+
+// Dia i como RegistroEnergia (cópia, ou decodificado do layout compacto)
+void lerDia(const TabelaDados* t, int i, RegistroEnergia* reg) {
+    if (t->completo != NULL) *reg = t->completo[i];
+    else descompactarRegistro(&t->compacto[i], reg);
+}
+
+// Um campo do dia i, em qualquer layout, sem montar o registro inteiro.
+// Campo ainda ausente volta como NaN (os int guardam 0 no registro).
+static double lerColunaDia(const TabelaDados* t, int i, const ColunaNumerica* col) {
+    unsigned ausentes = (t->completo != NULL) ? t->completo[i].ausentes : t->compacto[i].ausentes;
+    if (col->campo >= 0 && (ausentes & (1u << col->campo))) return NAN;
+    return (t->completo != NULL) ? lerColuna(&t->completo[i], col) : col->compacto(&t->compacto[i]);
+}
+
+// Data do dia i em dias desde 1970 (sem formatar texto no compacto). 0 = sem data.
+static int lerDataDia(const TabelaDados* t, int i, long* dias) {
+    if (t->completo != NULL) {
+        return !(t->completo[i].ausentes & (1u << CAMPO_DATA)) && converterData(t->completo[i].data, dias);
     }
-    
-    printf("\n--- Previsao (Dia %d) ---\n", n + 1);
+    if (t->compacto[i].data == DATA_AUSENTE) return 0;
+    *dias = EPOCA_COMPACTA + t->compacto[i].data;
+    return 1;
+}
 
-    // 1. Média Móvel 3
-    double mm3 = (dados[n-1].consumo + dados[n-2].consumo + dados[n-3].consumo) / 3.0;
-    printf("Previsao MM3: %.2f kWh\n", mm3);
+void gravarDia(TabelaDados* t, int i, const RegistroEnergia* reg) {
+    if (t->completo != NULL) t->completo[i] = *reg;
+    else compactarRegistro(reg, &t->compacto[i]);
+}
 
-    // 2. Regressão Linear Simples (Bônus)
-    double somaX = 0, somaY = 0, somaXY = 0, somaX2 = 0;
-    for (int i = 0; i < n; i++) {
-        double x = dados[i].irradiancia;
-        double y = dados[i].consumo;
-        somaX += x; somaY += y; somaXY += x * y; somaX2 += x * x;
+// --- Datas ---
+// "YYYY-MM-DD" <-> dias desde 1970-01-01 (calendário gregoriano proleptico).
+// Retorna 0 se o texto não for uma data válida.
+int converterData(const char* texto, long* dias) {
+    int a, m, d;
+    char resto;
+    if (sscanf(texto, "%4d-%2d-%2d%c", &a, &m, &d, &resto) != 3) return 0;
+    if (m < 1 || m > 12 || d < 1 || d > 31) return 0;
+
+    long ano = a - (m <= 2);
+    long era = (ano >= 0 ? ano : ano - 399) / 400;
+    long anoEra = ano - era * 400;
+    long diaAno = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long diaEra = anoEra * 365 + anoEra / 4 - anoEra / 100 + diaAno;
+    *dias = era * 146097 + diaEra - 719468;
+
+    // Rejeita 31/04, 30/02 etc.: a ida e volta tem que reproduzir o texto
+    char volta[11];
+    formatarData(*dias, volta);
+    return strncmp(volta, texto, 10) == 0;
+}
+
+void formatarData(long dias, char saida[11]) {
+    long z = dias + 719468;
+    long era = (z >= 0 ? z : z - 146096) / 146097;
+    long diaEra = z - era * 146097;
+    long anoEra = (diaEra - diaEra / 1460 + diaEra / 36524 - diaEra / 146096) / 365;
+    long diaAno = diaEra - (365 * anoEra + anoEra / 4 - anoEra / 100);
+    long mp = (5 * diaAno + 2) / 153;
+    int d = (int)(diaAno - (153 * mp + 2) / 5 + 1);
+    int m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    int a = (int)(anoEra + era * 400 + (m <= 2));
+    snprintf(saida, 11, "%04u-%02u-%02u", (unsigned)a % 10000u, (unsigned)m % 13u, (unsigned)d % 32u);
+}
+
+// --- Imputação de Ausentes ---
+// Preenche os NaN de uma coluna no lugar. Lacunas no início recebem o primeiro
+// valor válido; no fim, o último. Retorna quantos valores foram preenchidos.
+int imputarColuna(double v[], int n, MetodoImputacao metodo) {
+    int primeiro = 0;
+    while (primeiro < n && isnan(v[primeiro])) primeiro++;
+
+    double base = (primeiro < n) ? v[primeiro] : 0.0; // Coluna toda vazia: 0
+    for (int i = 0; i < primeiro; i++) v[i] = base;
+    int preenchidos = (primeiro < n) ? primeiro : n;
+
+    int anterior = primeiro; // Último índice com valor lido do arquivo
+    for (int i = primeiro + 1; i < n; i++) {
+        if (!isnan(v[i])) {
+            if (metodo == IMPUTA_LINEAR && i - anterior > 1) {
+                double passo = (v[i] - v[anterior]) / (i - anterior);
+                for (int k = anterior + 1; k < i; k++) v[k] = v[anterior] + passo * (k - anterior);
+            }
+            anterior = i;
+            continue;
+        }
+        // Linear: provisório até achar o próximo válido (fica assim no fim da série)
+        if (metodo == IMPUTA_MM3 && i >= 3) v[i] = (v[i-1] + v[i-2] + v[i-3]) / 3.0;
+        else v[i] = v[i-1];
+        preenchidos++;
     }
-    
-    double mediaX = somaX / n;
-    double mediaY = somaY / n;
-    double numerador = somaXY - (n * mediaX * mediaY);
-    double denominador = somaX2 - (n * mediaX * mediaX);
-    
-    if (denominador != 0) {
-        double b1 = numerador / denominador;
-        double b0 = mediaY - (b1 * mediaX);
-        printf("Regressao Linear (Consumo ~ Irradiancia): y = %.2f + %.2f*x\n", b0, b1);
+    return preenchidos;
+}
+
+// Preenche as datas vazias a partir do vizinho datado mais próximo (anterior,
+// senão o seguinte), deslocando pela diferença de 'dia' ou, sem ela, de posição.
+// Retorna quantas datas foram preenchidas; sem nenhuma data válida, nenhuma.
+static int imputarDatas(long datas[], const int temData[], const double dia[], int n) {
+    int preenchidas = 0;
+    for (int i = 0; i < n; i++) {
+        if (temData[i]) continue;
+        int vizinho = -1;
+        for (int j = i - 1; j >= 0 && vizinho < 0; j--) if (temData[j]) vizinho = j;
+        for (int j = i + 1; j < n && vizinho < 0; j++) if (temData[j]) vizinho = j;
+        if (vizinho < 0) return 0;
+
+        long deslocamento = (long)(dia[i] - dia[vizinho]);
+        if (deslocamento == 0) deslocamento = i - vizinho;
+        datas[i] = datas[vizinho] + deslocamento;
+        preenchidas++;
     }
+    return preenchidas;
 }
 
-// --- MAIN ---
-int main() {
-    // Configura localidade para usar vírgula em números e acentos
-    setlocale(LC_ALL, ""); 
-    
-    static RegistroEnergia dados[MAX_DIAS];
-    const char* arquivoEntrada = "consumo.csv";
+// Imputa, coluna a coluna, só as colunas que têm ausentes. contagem[campo]
+// recebe quantos valores de cada campo foram preenchidos; retorna o total.
+// Depois da imputação os bits de 'ausentes' ficam limpos (o de data só fica
+// se nenhum dia do arquivo tiver data).
+int imputarDados(TabelaDados* t, MetodoImputacao metodo, int contagem[NUM_CAMPOS]) {
+    int n = t->n;
+    unsigned colunas = 0;
+    RegistroEnergia reg;
+    long datas[MAX_DIAS];
+    int temData[MAX_DIAS];
 
-    printf("Lendo arquivo '%s'...\n", arquivoEntrada);
-    
-    int n = lerCSV(arquivoEntrada, dados, MAX_DIAS);
-    if (n <= 0) {
-        printf("Erro: Nao foi possivel ler dados ou arquivo vazio.\n");
-        return 1;
+    for (int i = 0; i < n; i++) {
+        colunas |= (t->completo != NULL) ? t->completo[i].ausentes : t->compacto[i].ausentes;
     }
-    printf("Sucesso: %d dias lidos.\n", n);
+    memset(contagem, 0, sizeof(int) * NUM_CAMPOS);
+    if (colunas == 0) return 0;
 
-    tratarDados(dados, n);
-    analisarDados(dados, n);
-    preverConsumo(dados, n);
+    double valores[NUM_COLUNAS_NUMERICAS][MAX_DIAS];
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < NUM_COLUNAS_NUMERICAS; c++) valores[c][i] = lerColunaDia(t, i, &COLUNAS_NUMERICAS[c]);
+        temData[i] = lerDataDia(t, i, &datas[i]);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    int total = 0;
+    for (int c = 0; c < NUM_COLUNAS_NUMERICAS; c++) {
+        int campo = COLUNAS_NUMERICAS[c].campo;
+        if (!(colunas & (1u << campo))) continue;
+        contagem[campo] = imputarColuna(valores[c], n, metodo);
+        total += contagem[campo];
+    }
+    if (colunas & (1u << CAMPO_DATA)) {
+        // valores[0] é a coluna "dia", já imputada
+        contagem[CAMPO_DATA] = imputarDatas(datas, temData, valores[0], n);
+        total += contagem[CAMPO_DATA];
+    }
+
+    for (int i = 0; i < n; i++) {
+        lerDia(t, i, &reg);
+        if (reg.ausentes == 0) continue;
+        for (int c = 0; c < NUM_COLUNAS_NUMERICAS; c++) {
+            if (reg.ausentes & (1u << COLUNAS_NUMERICAS[c].campo)) gravarColuna(&reg, &COLUNAS_NUMERICAS[c], valores[c][i]);
+        }
+        if ((reg.ausentes & (1u << CAMPO_DATA)) && contagem[CAMPO_DATA] > 0) {
+            formatarData(datas[i], reg.data);
+            reg.ausentes &= ~(1u << CAMPO_DATA);
+        }
+        reg.ausentes &= (1u << CAMPO_DATA);
+        gravarDia(t, i, &reg);
+    }
+    return total;
+}
+
+// --- Reduções Determinísticas ---
+// Toda soma de estatística passa por reduzirSoma: o vetor é cortado em blocos de
+// BLOCO_REDUCAO elementos, cada bloco é somado em ordem com compensação (Neumaier)
+// e as somas dos blocos são combinadas sempre na mesma árvore pareada. A forma da
+// soma depende só de n, então o resultado não muda com a ordem de chegada dos dados
+// nem com o número de threads de quem chama.
+
+void somarCompensado(SomaCompensada* s, double v) {
+    double t = s->soma + v;
+    if (fabs(s->soma) >= fabs(v)) s->compensacao += (s->soma - t) + v;
+    else s->compensacao += (v - t) + s->soma;
+    s->soma = t;
+}
+
+double totalCompensado(const SomaCompensada* s) {
+    return s->soma + s->compensacao;
+}
+
+static double somarBloco(const double* v, int n, int bloco) {
+    SomaCompensada s = {0, 0};
+    int fim = (bloco + 1) * BLOCO_REDUCAO;
+    if (fim > n) fim = n;
+    for (int i = bloco * BLOCO_REDUCAO; i < fim; i++) somarCompensado(&s, v[i]);
+    return totalCompensado(&s);
+}
+
+// Combina os blocos [ini, fim) sempre pela mesma árvore
+static double combinarPareado(const double* v, int n, int ini, int fim) {
+    if (fim - ini == 1) return somarBloco(v, n, ini);
+    int meio = ini + (fim - ini) / 2;
+    return combinarPareado(v, n, ini, meio) + combinarPareado(v, n, meio, fim);
+}
+
+double reduzirSoma(const double* v, int n) {
+    int nBlocos = (n + BLOCO_REDUCAO - 1) / BLOCO_REDUCAO;
+    if (nBlocos <= 0) return 0;
+    return combinarPareado(v, n, 0, nBlocos);
+}
+
+double mediaDeterministica(const double* v, int n) {
+    return (n > 0) ? reduzirSoma(v, n) / n : 0;
+}
+
+// Soma de (x - mx) * (y - my). 'termos' é área de trabalho com n posições.
+double somaCentrada(const double* x, double mx, const double* y, double my, int n, double* termos) {
+    for (int i = 0; i < n; i++) termos[i] = (x[i] - mx) * (y[i] - my);
+    return reduzirSoma(termos, n);
+}
+
+// Copia uma coluna para um vetor contíguo. Retorna 0 se o nome não existir.
+int extrairColuna(const TabelaDados* t, const char* nome, double* saida) {
+    const ColunaNumerica* col = buscarColuna(nome);
+    if (col == NULL) return 0;
+
+    for (int i = 0; i < t->n; i++) saida[i] = lerColunaDia(t, i, col);
+    return 1;
+}
+
+// --- Esboço de Quantis ---
+// Cada nível guarda até KLL_K itens. Quando enche, é ordenado e metade dos itens
+// (posições pares ou ímpares, alternando) sobe para o nível seguinte com o dobro
+// do peso. O erro de posição fica em torno de 1% para KLL_K = 200.
+typedef struct {
+    double valor;
+    long long peso;
+} ItemPonderado;
+
+static int compararDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int compararItemPonderado(const void* a, const void* b) {
+    return compararDouble(&((const ItemPonderado*)a)->valor, &((const ItemPonderado*)b)->valor);
+}
+
+static void compactarNivel(EsbocoQuantis* q, int h);
+
+static void empilharItem(EsbocoQuantis* q, int h, double v) {
+    if (q->tamanho[h] == KLL_K) {
+        if (h + 1 == KLL_NIVEIS) return; // Esboço saturado: descarta
+        compactarNivel(q, h);
+    }
+    q->itens[h][q->tamanho[h]++] = v;
+    if (h + 1 > q->niveis) q->niveis = h + 1;
+}
+
+static void compactarNivel(EsbocoQuantis* q, int h) {
+    double* itens = q->itens[h];
+    int tam = q->tamanho[h];
+    int inicio = (int)(q->compactacoes[h]++ & 1);
+
+    qsort(itens, tam, sizeof(double), compararDouble);
+    q->tamanho[h] = 0;
+    for (int i = inicio; i < tam; i += 2) empilharItem(q, h + 1, itens[i]);
+}
+
+void iniciarQuantis(EsbocoQuantis* q) {
+    memset(q, 0, sizeof(*q));
+    q->niveis = 1;
+}
+
+void inserirQuantil(EsbocoQuantis* q, double v) {
+    if (q->n == 0 || v < q->min) q->min = v;
+    if (q->n == 0 || v > q->max) q->max = v;
+    q->n++;
+    empilharItem(q, 0, v);
+}
+
+// Soma 'origem' em 'destino' nível a nível. O resultado depende só da ordem das
+// combinações, então combinar sempre na mesma ordem dá percentis reprodutíveis.
+void combinarQuantis(EsbocoQuantis* destino, const EsbocoQuantis* origem) {
+    if (origem->n == 0) return;
+    if (destino->n == 0 || origem->min < destino->min) destino->min = origem->min;
+    if (destino->n == 0 || origem->max > destino->max) destino->max = origem->max;
+    destino->n += origem->n;
+
+    for (int h = 0; h < origem->niveis; h++) {
+        for (int i = 0; i < origem->tamanho[h]; i++) empilharItem(destino, h, origem->itens[h][i]);
+    }
+}
+
+// Percentis p[] (0-1) pelo peso acumulado dos itens ordenados. Retorna 0 se o
+// esboço estiver vazio ou faltar memória.
+int calcularQuantis(const EsbocoQuantis* q, const double p[], int np, double saida[]) {
+    if (q->n == 0) return 0;
+
+    int total = 0;
+    for (int h = 0; h < q->niveis; h++) total += q->tamanho[h];
+    ItemPonderado* itens = (ItemPonderado*)malloc(sizeof(ItemPonderado) * total);
+    if (itens == NULL) return 0;
+
+    int k = 0;
+    long long pesoTotal = 0;
+    for (int h = 0; h < q->niveis; h++) {
+        for (int i = 0; i < q->tamanho[h]; i++) {
+            itens[k].valor = q->itens[h][i];
+            itens[k].peso = 1LL << h;
+            pesoTotal += itens[k++].peso;
+        }
+    }
+    qsort(itens, total, sizeof(ItemPonderado), compararItemPonderado);
+
+    for (int j = 0; j < np; j++) {
+        if (p[j] <= 0) { saida[j] = q->min; continue; }
+        if (p[j] >= 1) { saida[j] = q->max; continue; }
+        double alvo = p[j] * pesoTotal;
+        long long acumulado = 0;
+        int i = 0;
+        while (i < total - 1 && (acumulado += itens[i].peso) < alvo) i++;
+        saida[j] = itens[i].valor;
+    }
+
+    free(itens);
+    return 1;
+}
+
+// --- Funções Auxiliares de Tratamento ---
+double medianaJanela(const double consumo[], const int outlier[], int indice, int n) {
+    double soma = 0;
+    int count = 0;
+    for (int i = indice - JANELA_OUTLIER; i <= indice + JANELA_OUTLIER; i++) {
+        if (i >= 0 && i < n && !outlier[i]) {
+            soma += consumo[i];
+            count++;
+        }
+    }
+    return (count > 0) ? (soma / count) : consumo[indice];
+}
+
+// --- Função de Tratamento ---
+// Trabalha sobre colunas extraídas e grava de volta consumo, Z-score, flag de
+// outlier e os derivados (consumo líquido e custos) de cada dia.
+void tratarDados(TabelaDados* t) {
+    int n = t->n;
+    double consumo[MAX_DIAS], geracaoFV[MAX_DIAS], zscore[MAX_DIAS], termos[MAX_DIAS];
+    int outlier[MAX_DIAS];
+    RegistroEnergia reg;
+
+    extrairColuna(t, "consumo", consumo);
+    extrairColuna(t, "geracaoFV", geracaoFV);
+    extrairColuna(t, "zscoreConsumo", zscore);
+    for (int i = 0; i < n; i++) outlier[i] = 0;
+
+    // 1. Tratar Negativos
+    for (int i = 0; i < n; i++) {
+        if (consumo[i] < 0) consumo[i] = (i > 0) ? consumo[i-1] : 0;
+        if (geracaoFV[i] < 0) geracaoFV[i] = (i > 0) ? geracaoFV[i-1] : 0;
+    }
+
+    // 2. Tratar Outliers (Z-Score > 3)
+    if (n == 0) return;
+
+    double mediaConsumo = mediaDeterministica(consumo, n);
+    double stdDevConsumo = sqrt(somaCentrada(consumo, mediaConsumo, consumo, mediaConsumo, n, termos) / n);
+
+    printf("\n--- Tratamento de Outliers ---\n");
+    printf("Media: %.2f, Desvio Padrao: %.2f\n", mediaConsumo, stdDevConsumo);
+
+    if (stdDevConsumo > 0) {
+        for (int i = 0; i < n; i++) {
+            zscore[i] = (consumo[i] - mediaConsumo) / stdDevConsumo;
+            outlier[i] = (fabs(zscore[i]) > Z_SCORE_LIMITE);
+
+            if (outlier[i]) {
+                printf("Outlier Dia %d: %.2f (Z=%.2f). Corrigindo...\n",
+                       (int)lerColunaDia(t, i, buscarColuna("dia")), consumo[i], zscore[i]);
+                consumo[i] = medianaJanela(consumo, outlier, i, n);
+            }
+        }
+    }
+
+    // 3. Gravar o resultado e os derivados do dia
+    for (int i = 0; i < n; i++) {
+        lerDia(t, i, &reg);
+        reg.consumo = consumo[i];
+        reg.geracaoFV = geracaoFV[i];
+        reg.zscoreConsumo = zscore[i];
+        reg.ehOutlier = outlier[i];
+        reg.consumoLiquido = reg.consumo - reg.geracaoFV;
+        calcularCustos(&reg);
+        gravarDia(t, i, &reg);
+    }
+}
+
+// --- Função Auxiliar de Correlação ---
+// Correlação consumo x 'var'. Média e soma dos quadrados do consumo vêm dos Momentos.
+double calcularCorrelacao(const TabelaDados* t, const Momentos* m, const char* var) {
+    double consumo[MAX_DIAS], y[MAX_DIAS], termos[MAX_DIAS];
+    int n = t->n;
+    if (n <= 0 || n > MAX_DIAS || !extrairColuna(t, "consumo", consumo) || !extrairColuna(t, var, y)) return 0;
+
+    double mediaY = mediaDeterministica(y, n);
+    double numerador = somaCentrada(consumo, m->mediaConsumo, y, mediaY, n, termos);
+    double denominador = sqrt(m->somaQuadConsumo * somaCentrada(y, mediaY, y, mediaY, n, termos));
+    return (denominador == 0) ? 0 : numerador / denominador;
+}
+
+// --- Correlação Cruzada Defasada (FFT) ---
+// FFT radix-2 in-place (m potência de 2). inversa=1 inclui a divisão por m.
+static void fft(double* re, double* im, int m, int inversa) {
+    for (int i = 1, j = 0; i < m; i++) {
+        int bit = m >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int tam = 2; tam <= m; tam <<= 1) {
+        double angulo = (inversa ? 2.0 : -2.0) * M_PI / tam;
+        for (int k = 0; k < tam / 2; k++) {
+            double wRe = cos(angulo * k), wIm = sin(angulo * k);
+            for (int i = k; i < m; i += tam) {
+                int j = i + tam / 2;
+                double tRe = re[j] * wRe - im[j] * wIm;
+                double tIm = re[j] * wIm + im[j] * wRe;
+                re[j] = re[i] - tRe; im[j] = im[i] - tIm;
+                re[i] += tRe; im[i] += tIm;
+            }
+        }
+    }
+    if (inversa) {
+        for (int i = 0; i < m; i++) { re[i] /= m; im[i] /= m; }
+    }
+}
+
+// Correlação entre x[t] e y[t-k] para k = 0..maxDefasagem (y antecede x em k passos),
+// normalizada pelas variâncias da série inteira. O(m log m) com m >= 2n.
+// Retorna 0 se faltar memória ou uma das séries for constante.
+int correlacaoDefasada(const double* x, const double* y, int n, int maxDefasagem, double* saida) {
+    if (n < 2) return 0;
+    if (maxDefasagem > n - 1) maxDefasagem = n - 1;
+
+    int m = 1;
+    while (m < 2 * n) m <<= 1;
+
+    double* buffer = calloc((size_t)m * 4, sizeof(double));
+    double* termos = malloc(sizeof(double) * n);
+    if (buffer == NULL || termos == NULL) {
+        free(buffer);
+        free(termos);
+        return 0;
+    }
+    double *xRe = buffer, *xIm = buffer + m, *yRe = buffer + 2 * m, *yIm = buffer + 3 * m;
+
+    double mediaX = mediaDeterministica(x, n);
+    double mediaY = mediaDeterministica(y, n);
+    double denominador = sqrt(somaCentrada(x, mediaX, x, mediaX, n, termos) *
+                              somaCentrada(y, mediaY, y, mediaY, n, termos));
+    free(termos);
+    if (denominador == 0) {
+        free(buffer);
+        return 0;
+    }
+
+    // Séries centradas com zeros até m (evita a correlação circular)
+    for (int i = 0; i < n; i++) {
+        xRe[i] = x[i] - mediaX;
+        yRe[i] = y[i] - mediaY;
+    }
+    fft(xRe, xIm, m, 0);
+    fft(yRe, yIm, m, 0);
+
+    // X * conj(Y) -> soma_t x[t+k] * y[t]
+    for (int i = 0; i < m; i++) {
+        double re = xRe[i] * yRe[i] + xIm[i] * yIm[i];
+        double im = xIm[i] * yRe[i] - xRe[i] * yIm[i];
+        xRe[i] = re;
+        xIm[i] = im;
+    }
+    fft(xRe, xIm, m, 1);
+
+    for (int k = 0; k <= maxDefasagem; k++) {
+        saida[k] = xRe[k] / denominador;
+    }
+    free(buffer);
+    return 1;
+}
+
+// Consumo vs cada variável numérica, defasagens 0..maxDefasagem dias
+void analisarDefasagens(const TabelaDados* t, int maxDefasagem) {
+    static const char* variaveis[] = {
+        "temp", "umidade", "irradiancia", "vento", "ocupacao", "diaUtil",
+        "feriado", "tarifaPonta", "geracaoFV", "cargaVE", "importacaoRede"
+    };
+    int nVars = sizeof(variaveis) / sizeof(variaveis[0]);
+    double consumo[MAX_DIAS], coluna[MAX_DIAS];
+    static double correlacoes[sizeof(variaveis) / sizeof(variaveis[0])][MAX_DIAS];
+    int n = t->n;
+
+    printf("\n--- Correlacao Cruzada Defasada (Consumo[t] vs Variavel[t-k]) ---\n");
+    if (n < 2) {
+        printf("Dados insuficientes.\n");
+        return;
+    }
+    if (maxDefasagem > n - 1) maxDefasagem = n - 1;
+
+    extrairColuna(t, "consumo", consumo);
+    for (int v = 0; v < nVars; v++) {
+        extrairColuna(t, variaveis[v], coluna);
+        if (!correlacaoDefasada(consumo, coluna, n, maxDefasagem, correlacoes[v])) {
+            for (int k = 0; k <= maxDefasagem; k++) correlacoes[v][k] = 0;
+        }
+    }
+
+    printf("%4s", "k");
+    for (int v = 0; v < nVars; v++) printf(" %8.8s", variaveis[v]);
+    printf("\n");
+    for (int k = 0; k <= maxDefasagem; k++) {
+        printf("%4d", k);
+        for (int v = 0; v < nVars; v++) printf(" %8.4f", correlacoes[v][k]);
+        printf("\n");
+    }
+
+    printf("\nMaior |correlacao| por variavel:\n");
+    for (int v = 0; v < nVars; v++) {
+        int melhor = 0;
+        for (int k = 1; k <= maxDefasagem; k++) {
+            if (fabs(correlacoes[v][k]) > fabs(correlacoes[v][melhor])) melhor = k;
+        }
+        printf("  %-15s k=%-3d r=%.4f\n", variaveis[v], melhor, correlacoes[v][melhor]);
+    }
+}
+
+// --- Função de Custos ---
+// A tarifa do CSV (TarifaPonta) é aplicada a toda a energia do dia.
+// A recarga do VE é tratada como carga marginal: sai primeiro da importação.
+// A economia FV é a importação evitada: demanda (consumo + VE) menos importação,
+// limitada à geração do dia.
+void calcularCustos(RegistroEnergia* reg) {
+    double demanda = reg->consumo + reg->cargaVE;
+    double autoconsumo = demanda - reg->importacaoRede;
+    if (autoconsumo < 0) autoconsumo = 0;
+    if (autoconsumo > reg->geracaoFV) autoconsumo = reg->geracaoFV;
+
+    reg->custoRede = reg->importacaoRede * reg->tarifaPonta;
+    reg->custoVE = fmin(reg->cargaVE, reg->importacaoRede) * reg->tarifaPonta;
+    reg->economiaFV = autoconsumo * reg->tarifaPonta;
+}
+
+// --- Função de Análise (CORRIGIDA) ---
+static int compararPeriodo(const void* a, const void* b) {
+    return strcmp(((const ResumoPeriodo*)a)->periodo, ((const ResumoPeriodo*)b)->periodo);
+}
+
+static const double PERCENTIS[] = {0.50, 0.95, 0.99};
+
+static void imprimirPercentis(FILE* saida, const EsbocoQuantis* cons, const EsbocoQuantis* imp) {
+    double c[3], i[3];
+    if (!calcularQuantis(cons, PERCENTIS, 3, c) || !calcularQuantis(imp, PERCENTIS, 3, i)) return;
+    fprintf(saida, "Percentis:\n");
+    fprintf(saida, "  Consumo (kWh):    P50=%.2f  P95=%.2f  P99=%.2f\n", c[0], c[1], c[2]);
+    fprintf(saida, "  Importacao (kWh): P50=%.2f  P95=%.2f  P99=%.2f\n", i[0], i[1], i[2]);
+}
+
+void analisarDados(const TabelaDados* t, const Momentos* m) {
+    int n = t->n;
+    RegistroEnergia reg;
+
+    printf("\n--- Analise Estatistica ---\n");
+
+    if (n == 0) return;
+
+    // Inicialização
+    lerDia(t, 0, &reg);
+    double minCons = reg.consumo, maxCons = reg.consumo;
+    double minFV = reg.geracaoFV, maxFV = reg.geracaoFV;
+    double minImp = reg.importacaoRede, maxImp = reg.importacaoRede;
+
+    ResumoPeriodo periodos[MAX_PERIODOS + 1];
+    ResumoPeriodo outros = {"outros", 0, 0, 0, 0, 0}; // Dias sem data ou além de MAX_PERIODOS meses
+    int nPeriodos = 0, semData = 0;
+
+    static EsbocoQuantis quantisCons, quantisImp;
+    iniciarQuantis(&quantisCons);
+    iniciarQuantis(&quantisImp);
+
+    double consUtil[MAX_DIAS], consFDS[MAX_DIAS];
+    int nUtil = 0, nFDS = 0;
+
+    for (int i = 0; i < n; i++) {
+        lerDia(t, i, &reg);
+
+        // Agrupar por mês ("YYYY-MM"), procurando o mês pela chave
+        ResumoPeriodo* p = NULL;
+        if (reg.data[0] == '\0') semData++;
+        else {
+            for (int k = 0; k < nPeriodos && p == NULL; k++) {
+                if (strncmp(periodos[k].periodo, reg.data, 7) == 0) p = &periodos[k];
+            }
+            if (p == NULL && nPeriodos < MAX_PERIODOS) {
+                p = &periodos[nPeriodos++];
+                memset(p, 0, sizeof(ResumoPeriodo));
+                memcpy(p->periodo, reg.data, 7);
+            }
+        }
+        if (p == NULL) p = &outros;
+        p->dias++;
+        p->importacao += reg.importacaoRede;
+        p->custoRede += reg.custoRede;
+        p->custoVE += reg.custoVE;
+        p->economiaFV += reg.economiaFV;
+
+        // Min/Max Consumo
+        if (reg.consumo < minCons) minCons = reg.consumo;
+        if (reg.consumo > maxCons) maxCons = reg.consumo;
+
+        // Min/Max Geração FV (CORREÇÃO APLICADA AQUI)
+        if (reg.geracaoFV < minFV) minFV = reg.geracaoFV;
+        if (reg.geracaoFV > maxFV) maxFV = reg.geracaoFV;
+
+        // Min/Max Importação (CORREÇÃO APLICADA AQUI)
+        if (reg.importacaoRede < minImp) minImp = reg.importacaoRede;
+        if (reg.importacaoRede > maxImp) maxImp = reg.importacaoRede;
+
+        inserirQuantil(&quantisCons, reg.consumo);
+        inserirQuantil(&quantisImp, reg.importacaoRede);
+
+        // Comparação Dia Útil
+        if (reg.diaUtil == 1 && reg.feriado == 0) {
+            consUtil[nUtil++] = reg.consumo;
+        } else {
+            consFDS[nFDS++] = reg.consumo;
+        }
+    }
+
+    printf("Estatisticas Descritivas (N=%d dias):\n", n);
+    printf("  Consumo (kWh):    Media=%.2f  Min=%.2f  Max=%.2f\n", m->mediaConsumo, minCons, maxCons);
+    printf("  Geracao FV (kWh): Media=%.2f  Min=%.2f  Max=%.2f\n", m->mediaGeracaoFV, minFV, maxFV);
+    printf("  Importacao (kWh): Media=%.2f  Min=%.2f  Max=%.2f\n", m->mediaImportacao, minImp, maxImp);
+    imprimirPercentis(stdout, &quantisCons, &quantisImp);
+
+    // Correlações
+    printf("\nCorrelacoes (vs Consumo):\n");
+    printf("  vs Temperatura: %.4f\n", calcularCorrelacao(t, m, "temp"));
+    printf("  vs Umidade:     %.4f\n", calcularCorrelacao(t, m, "umidade"));
+    printf("  vs Ocupacao:    %.4f\n", calcularCorrelacao(t, m, "ocupacao"));
+    printf("  vs Irradiancia: %.4f\n", calcularCorrelacao(t, m, "irradiancia"));
+
+    printf("\nMedia Consumo: Dia Util (%.2f) vs FDS/Feriado (%.2f)\n", 
+           mediaDeterministica(consUtil, nUtil), mediaDeterministica(consFDS, nFDS));
+
+    // Custos por período, em ordem de mês; "outros" por último
+    double totalRede = 0, totalVE = 0, totalFV = 0;
+    qsort(periodos, nPeriodos, sizeof(ResumoPeriodo), compararPeriodo);
+    if (outros.dias > 0) periodos[nPeriodos++] = outros; // Cabe: MAX_PERIODOS + 1 posições
+    printf("\nCustos por Mes (R$):\n");
+    printf("  %-7s %5s %12s %12s %10s %12s\n", "Mes", "Dias", "Importacao", "CustoRede", "CustoVE", "EconomiaFV");
+    for (int p = 0; p < nPeriodos; p++) {
+        printf("  %-7s %5d %12.0f %12.2f %10.2f %12.2f\n", periodos[p].periodo, periodos[p].dias,
+               periodos[p].importacao, periodos[p].custoRede, periodos[p].custoVE, periodos[p].economiaFV);
+        totalRede += periodos[p].custoRede;
+        totalVE += periodos[p].custoVE;
+        totalFV += periodos[p].economiaFV;
+    }
+    printf("  Total: Rede=%.2f  VE=%.2f (%.1f%%)  Economia FV=%.2f  Custo medio diario=%.2f\n",
+           totalRede, totalVE, (totalRede > 0 ? 100.0 * totalVE / totalRede : 0), totalFV, totalRede / n);
+    if (outros.dias > 0) {
+        printf("  outros: %d dias sem data, %d de meses alem dos %d primeiros\n",
+               semData, outros.dias - semData, MAX_PERIODOS);
+    }
+}
+
+// --- Função de Previsão ---
+void preverConsumo(const TabelaDados* t, const ModeloLinear* modelo) {
+    int n = t->n;
+    if (n < 3) {
+        printf("Dados insuficientes para previsao.\n");
+        return;
+    }
+    
+    printf("\n--- Previsao (Dia %d) ---\n", n + 1);
+
+    // 1. Média Móvel 3
+    double mm3 = 0;
+    const ColunaNumerica* consumo = buscarColuna("consumo");
+    for (int i = n - JANELA_MM3; i < n; i++) mm3 += lerColunaDia(t, i, consumo);
+    mm3 /= JANELA_MM3;
+    printf("Previsao MM3: %.2f kWh\n", mm3);
+
+    // 2. Regressão Linear Simples (Bônus)
+    if (modelo->valido) {
+        printf("Regressao Linear (Consumo ~ Irradiancia): y = %.2f + %.2f*x\n", modelo->b0, modelo->b1);
+    }
+}
+
+// --- Momentos e Modelo ---
+void calcularMomentos(const TabelaDados* t, Momentos* m) {
+    double consumo[MAX_DIAS], irradiancia[MAX_DIAS], coluna[MAX_DIAS], termos[MAX_DIAS];
+    int n = t->n;
+
+    memset(m, 0, sizeof(*m));
+    if (n <= 0) return;
+
+    extrairColuna(t, "consumo", consumo);
+    extrairColuna(t, "irradiancia", irradiancia);
+    m->mediaConsumo = mediaDeterministica(consumo, n);
+    m->mediaIrradiancia = mediaDeterministica(irradiancia, n);
+    extrairColuna(t, "geracaoFV", coluna);
+    m->mediaGeracaoFV = mediaDeterministica(coluna, n);
+    extrairColuna(t, "importacaoRede", coluna);
+    m->mediaImportacao = mediaDeterministica(coluna, n);
+
+    m->somaQuadConsumo = somaCentrada(consumo, m->mediaConsumo, consumo, m->mediaConsumo, n, termos);
+    m->somaQuadIrradiancia = somaCentrada(irradiancia, m->mediaIrradiancia, irradiancia, m->mediaIrradiancia, n, termos);
+    m->somaCruzadaIrradianciaConsumo = somaCentrada(irradiancia, m->mediaIrradiancia, consumo, m->mediaConsumo, n, termos);
+}
+
+void ajustarModelo(const Momentos* m, ModeloLinear* modelo) {
+    modelo->valido = (m->somaQuadIrradiancia != 0);
+    modelo->b1 = modelo->valido ? m->somaCruzadaIrradianciaConsumo / m->somaQuadIrradiancia : 0;
+    modelo->b0 = m->mediaConsumo - (modelo->b1 * m->mediaIrradiancia);
+}
+
+// --- Exportação ---
+void exportarCSV(const char* nomeArquivo, const TabelaDados* t, const ModeloLinear* modelo) {
+    FILE* f = fopen(nomeArquivo, "w");
+    if (!f) { printf("Erro ao criar arquivo de exportacao.\n"); return; }
+
+    fprintf(f, "Dia;Data;ConsumoTratado;ConsumoLiquido;GeraçãoFV;ZScore;EhOutlier;Prev_MM3;Prev_Linear\n");
+
+    double ultimos[JANELA_MM3] = {0}; // Consumo dos 3 dias anteriores (circular)
+    RegistroEnergia reg;
+    for (int i = 0; i < t->n; i++) {
+        lerDia(t, i, &reg);
+        double mm3 = (i >= JANELA_MM3) ? (ultimos[0] + ultimos[1] + ultimos[2]) / 3.0 : 0.0;
+        double prevLinear = modelo->b0 + modelo->b1 * reg.irradiancia;
+
+        fprintf(f, "%d;%s;%.2f;%.2f;%.2f;%.4f;%d;%.2f;%.2f\n",
+            reg.dia,
+            reg.data,
+            reg.consumo,
+            reg.consumo - reg.geracaoFV,
+            reg.geracaoFV,
+            reg.zscoreConsumo,
+            reg.ehOutlier,
+            mm3,
+            prevLinear
+        );
+        ultimos[i % JANELA_MM3] = reg.consumo;
+    }
+    fclose(f);
+    printf("\nArquivo '%s' exportado com sucesso!\n", nomeArquivo);
+}
+
+// --- Armazenamento Compacto ---
+// Codificação (erro máximo por campo, após o arredondamento):
+//   temp, umidade, vento, ocupacao: inteiro x10     -> ±0.05
+//   irradiancia:                    inteiro x100    -> ±0.005
+//   tarifaPonta:                    inteiro x1000   -> ±0.0005
+//   consumo, geracaoFV, cargaVE,
+//   importacaoRede, zscore:         float32         -> relativo 2^-24 (~6e-8)
+//   diaUtil, feriado, ehOutlier:    bits de flags   -> exato
+//   data:                           dias desde 2000  -> exato até 2179
+//   dia:                            uint16          -> exato em 0..65535
+// Valores fora da faixa do inteiro são saturados e contados.
+static int16_t codificarEscalado(double v, double escala, int minimo, int maximo, int* saturados) {
+    if (isnan(v)) return 0; // Ausente: o bit em 'ausentes' marca a falta
+    double q = floor(v * escala + 0.5);
+    if (q < minimo) { q = minimo; (*saturados)++; }
+    if (q > maximo) { q = maximo; (*saturados)++; }
+    return (int16_t)q;
+}
+
+// Codifica um dia. Retorna quantos valores saturaram.
+int compactarRegistro(const RegistroEnergia* reg, RegistroCompacto* c) {
+    int saturados = 0;
+    long dias;
+    if (reg->dia < 0 || reg->dia > UINT16_MAX) saturados++;
+    c->dia = (uint16_t)(reg->dia < 0 ? 0 : (reg->dia > UINT16_MAX ? UINT16_MAX : reg->dia));
+    c->data = DATA_AUSENTE;
+    if (converterData(reg->data, &dias)) {
+        if (dias >= EPOCA_COMPACTA && dias - EPOCA_COMPACTA < DATA_AUSENTE) c->data = (uint16_t)(dias - EPOCA_COMPACTA);
+        else saturados++; // Data válida fora de 2000..2179
+    }
+    c->ausentes = (uint16_t)reg->ausentes;
+    c->flags = (uint8_t)((reg->diaUtil ? FLAG_DIA_UTIL : 0) |
+                         (reg->feriado ? FLAG_FERIADO : 0) |
+                         (reg->ehOutlier ? FLAG_OUTLIER : 0));
+    c->temp = codificarEscalado(reg->temp, ESCALA_DECIMO, INT16_MIN, INT16_MAX, &saturados);
+    c->umidade = codificarEscalado(reg->umidade, ESCALA_DECIMO, INT16_MIN, INT16_MAX, &saturados);
+    c->irradiancia = codificarEscalado(reg->irradiancia, ESCALA_CENTESIMO, INT16_MIN, INT16_MAX, &saturados);
+    c->vento = codificarEscalado(reg->vento, ESCALA_DECIMO, INT16_MIN, INT16_MAX, &saturados);
+    c->ocupacao = codificarEscalado(reg->ocupacao, ESCALA_DECIMO, INT16_MIN, INT16_MAX, &saturados);
+    c->tarifaPonta = codificarEscalado(reg->tarifaPonta, ESCALA_MILESIMO, INT16_MIN, INT16_MAX, &saturados);
+    c->consumo = (float)reg->consumo;
+    c->geracaoFV = (float)reg->geracaoFV;
+    c->cargaVE = (float)reg->cargaVE;
+    c->importacaoRede = (float)reg->importacaoRede;
+    c->zscoreConsumo = (float)reg->zscoreConsumo;
+    return saturados;
+}
+
+// Decodifica um dia. Campos inteiros ainda ausentes voltam como NaN, como na leitura.
+void descompactarRegistro(const RegistroCompacto* c, RegistroEnergia* reg) {
+    memset(reg, 0, sizeof(*reg));
+    for (int k = 0; k < NUM_COLUNAS_NUMERICAS; k++) {
+        const ColunaNumerica* col = &COLUNAS_NUMERICAS[k];
+        gravarColuna(reg, col, (c->ausentes & (1u << col->campo)) ? NAN : col->compacto(c));
+    }
+    if (c->data != DATA_AUSENTE) formatarData(EPOCA_COMPACTA + c->data, reg->data);
+    reg->ausentes = c->ausentes;
+    reg->ehOutlier = (c->flags & FLAG_OUTLIER) != 0;
+    reg->zscoreConsumo = c->zscoreConsumo;
+    reg->consumoLiquido = reg->consumo - reg->geracaoFV;
+    calcularCustos(reg);
+}
+
+// Maior erro absoluto da codificação de um dia (verificação do limite documentado)
+double erroCompactacao(const RegistroEnergia* original, const RegistroEnergia* decodificado) {
+    double erro = 0;
+    erro = fmax(erro, fabs(decodificado->temp - original->temp));
+    erro = fmax(erro, fabs(decodificado->umidade - original->umidade));
+    erro = fmax(erro, fabs(decodificado->irradiancia - original->irradiancia));
+    erro = fmax(erro, fabs(decodificado->vento - original->vento));
+    erro = fmax(erro, fabs(decodificado->ocupacao - original->ocupacao));
+    erro = fmax(erro, fabs(decodificado->tarifaPonta - original->tarifaPonta));
+    erro = fmax(erro, fabs(decodificado->consumo - original->consumo));
+    erro = fmax(erro, fabs(decodificado->geracaoFV - original->geracaoFV));
+    erro = fmax(erro, fabs(decodificado->cargaVE - original->cargaVE));
+    erro = fmax(erro, fabs(decodificado->importacaoRede - original->importacaoRede));
+    erro = fmax(erro, fabs(decodificado->zscoreConsumo - original->zscoreConsumo));
+    return erro; // fmax ignora NaN (campos ausentes)
+}
+
+// --- Modo Fluxo (stdin / pipe) ---
+// Atualização de Welford: estável e determinística (ordem fixa de chegada)
+void acumularCorrelacao(AcumuladorCorrelacao* acc, double x, double y) {
+    acc->n++;
+    double dx = x - acc->mediaX;
+    acc->mediaX += dx / acc->n;
+    double dy = y - acc->mediaY;
+    acc->mediaY += dy / acc->n;
+    acc->m2X += dx * (x - acc->mediaX);
+    acc->m2Y += dy * (y - acc->mediaY);
+    acc->coMomento += dx * (y - acc->mediaY);
+}
+
+double correlacaoAcumulada(const AcumuladorCorrelacao* acc) {
+    double denominador = sqrt(acc->m2X * acc->m2Y);
+    return (denominador == 0) ? 0 : acc->coMomento / denominador;
+}
+
+static RegistroEnergia* registroFluxo(EstadoFluxo* st, long indice) {
+    return &st->janela[indice % JANELA_FLUXO];
+}
+
+// Mesma regra de medianaJanela, mas sobre o buffer circular
+double medianaJanelaFluxo(EstadoFluxo* st, long indice) {
+    double soma = 0;
+    int count = 0;
+    for (long i = indice - JANELA_OUTLIER; i <= indice + JANELA_OUTLIER; i++) {
+        if (i >= 0 && i < st->lidos && !registroFluxo(st, i)->ehOutlier) {
+            soma += registroFluxo(st, i)->consumo;
+            count++;
+        }
+    }
+    return (count > 0) ? (soma / count) : registroFluxo(st, indice)->consumo;
+}
+
+// Trata, acumula e emite o dia mais antigo ainda pendente
+void emitirFluxo(EstadoFluxo* st) {
+    long e = st->emitidos;
+    RegistroEnergia* reg = registroFluxo(st, e);
+
+    // Z-score contra média/desvio correntes (todos os dias já recebidos)
+    double desvio = sqrt(st->m2Bruta / st->lidos);
+    if (desvio > 0) {
+        reg->zscoreConsumo = (reg->consumo - st->mediaBruta) / desvio;
+        reg->ehOutlier = (st->lidos >= MIN_AMOSTRAS_FLUXO && fabs(reg->zscoreConsumo) > Z_SCORE_LIMITE);
+        if (reg->ehOutlier) {
+            fprintf(stderr, "Outlier Dia %d: %.2f (Z=%.2f). Corrigindo...\n", reg->dia, reg->consumo, reg->zscoreConsumo);
+            reg->consumo = medianaJanelaFluxo(st, e);
+            st->outliers++;
+        }
+    }
+    reg->consumoLiquido = reg->consumo - reg->geracaoFV;
+    calcularCustos(reg);
+    somarCompensado(&st->somaCustoRede, reg->custoRede);
+    somarCompensado(&st->somaCustoVE, reg->custoVE);
+    somarCompensado(&st->somaEconomiaFV, reg->economiaFV);
+
+    // Estatísticas descritivas
+    if (e == 0) {
+        st->minCons = st->maxCons = reg->consumo;
+        st->minFV = st->maxFV = reg->geracaoFV;
+        st->minImp = st->maxImp = reg->importacaoRede;
+    }
+    somarCompensado(&st->somaCons, reg->consumo);
+    somarCompensado(&st->somaFV, reg->geracaoFV);
+    somarCompensado(&st->somaImp, reg->importacaoRede);
+    inserirQuantil(&st->quantisCons, reg->consumo);
+    inserirQuantil(&st->quantisImp, reg->importacaoRede);
+    if (reg->consumo < st->minCons) st->minCons = reg->consumo;
+    if (reg->consumo > st->maxCons) st->maxCons = reg->consumo;
+    if (reg->geracaoFV < st->minFV) st->minFV = reg->geracaoFV;
+    if (reg->geracaoFV > st->maxFV) st->maxFV = reg->geracaoFV;
+    if (reg->importacaoRede < st->minImp) st->minImp = reg->importacaoRede;
+    if (reg->importacaoRede > st->maxImp) st->maxImp = reg->importacaoRede;
+
+    if (reg->diaUtil == 1 && reg->feriado == 0) {
+        somarCompensado(&st->somaUtil, reg->consumo); st->nUtil++;
+    } else {
+        somarCompensado(&st->somaFDS, reg->consumo); st->nFDS++;
+    }
+
+    acumularCorrelacao(&st->corrTemp, reg->consumo, reg->temp);
+    acumularCorrelacao(&st->corrUmidade, reg->consumo, reg->umidade);
+    acumularCorrelacao(&st->corrOcupacao, reg->consumo, reg->ocupacao);
+    acumularCorrelacao(&st->corrIrradiancia, reg->consumo, reg->irradiancia);
+    acumularCorrelacao(&st->regressao, reg->irradiancia, reg->consumo);
+
+    // Previsão para este dia com os JANELA_MM3 dias anteriores, como em exportarCSV
+    double mm3 = 0;
+    if (e >= JANELA_MM3) {
+        for (int i = 0; i < JANELA_MM3; i++) mm3 += st->ultimosTratados[i];
+        mm3 /= JANELA_MM3;
+    }
+    st->ultimosTratados[e % JANELA_MM3] = reg->consumo;
+
+    printf("%d;%.2f;%.4f;%d;%.2f\n", reg->dia, reg->consumo, reg->zscoreConsumo, reg->ehOutlier, mm3);
+    fflush(stdout);
+    st->emitidos++;
+}
+
+// Recebe um dia novo; emite o dia cuja janela de outlier ficou completa
+void receberFluxo(EstadoFluxo* st, const RegistroEnergia* novo) {
+    RegistroEnergia* reg = registroFluxo(st, st->lidos);
+    *reg = *novo;
+
+    // Ausentes: sem o futuro, só dá para repetir o último valor (imputação "ultimo")
+    if (reg->ausentes != 0) {
+        for (int c = 0; c < NUM_COLUNAS_NUMERICAS; c++) {
+            if (!(reg->ausentes & (1u << COLUNAS_NUMERICAS[c].campo))) continue;
+            double v = (st->lidos > 0) ? lerColuna(registroFluxo(st, st->lidos - 1), &COLUNAS_NUMERICAS[c]) : 0.0;
+            gravarColuna(reg, &COLUNAS_NUMERICAS[c], v);
+        }
+    }
+
+    // Negativos: mesma regra de tratarDados (valor do dia anterior)
+    if (st->lidos > 0) {
+        RegistroEnergia* anterior = registroFluxo(st, st->lidos - 1);
+        if (reg->consumo < 0) reg->consumo = anterior->consumo;
+        if (reg->geracaoFV < 0) reg->geracaoFV = anterior->geracaoFV;
+    } else {
+        if (reg->consumo < 0) reg->consumo = 0;
+        if (reg->geracaoFV < 0) reg->geracaoFV = 0;
+    }
+
+    st->lidos++;
+    double delta = reg->consumo - st->mediaBruta;
+    st->mediaBruta += delta / st->lidos;
+    st->m2Bruta += delta * (reg->consumo - st->mediaBruta);
+
+    if (st->lidos - st->emitidos > JANELA_OUTLIER) {
+        emitirFluxo(st);
+    }
+}
+
+// Resumo vai para stderr: stdout fica só com o CSV dos dias tratados
+void resumirFluxo(const EstadoFluxo* st) {
+    long n = st->emitidos;
+    fprintf(stderr, "\n--- Analise Estatistica (Fluxo) ---\n");
+    if (n == 0) return;
+
+    fprintf(stderr, "Estatisticas Descritivas (N=%ld dias, %d outliers corrigidos):\n", n, st->outliers);
+    fprintf(stderr, "  Consumo (kWh):    Media=%.2f  Min=%.2f  Max=%.2f\n", totalCompensado(&st->somaCons)/n, st->minCons, st->maxCons);
+    fprintf(stderr, "  Geracao FV (kWh): Media=%.2f  Min=%.2f  Max=%.2f\n", totalCompensado(&st->somaFV)/n, st->minFV, st->maxFV);
+    fprintf(stderr, "  Importacao (kWh): Media=%.2f  Min=%.2f  Max=%.2f\n", totalCompensado(&st->somaImp)/n, st->minImp, st->maxImp);
+    imprimirPercentis(stderr, &st->quantisCons, &st->quantisImp);
+
+    fprintf(stderr, "\nCorrelacoes (vs Consumo):\n");
+    fprintf(stderr, "  vs Temperatura: %.4f\n", correlacaoAcumulada(&st->corrTemp));
+    fprintf(stderr, "  vs Umidade:     %.4f\n", correlacaoAcumulada(&st->corrUmidade));
+    fprintf(stderr, "  vs Ocupacao:    %.4f\n", correlacaoAcumulada(&st->corrOcupacao));
+    fprintf(stderr, "  vs Irradiancia: %.4f\n", correlacaoAcumulada(&st->corrIrradiancia));
+
+    fprintf(stderr, "\nMedia Consumo: Dia Util (%.2f) vs FDS/Feriado (%.2f)\n",
+           (st->nUtil>0 ? totalCompensado(&st->somaUtil)/st->nUtil : 0),
+           (st->nFDS>0 ? totalCompensado(&st->somaFDS)/st->nFDS : 0));
+
+    fprintf(stderr, "\nCustos (R$): Rede=%.2f  VE=%.2f  Economia FV=%.2f  Custo medio diario=%.2f\n",
+           totalCompensado(&st->somaCustoRede), totalCompensado(&st->somaCustoVE),
+           totalCompensado(&st->somaEconomiaFV), totalCompensado(&st->somaCustoRede) / n);
+
+    if (n < JANELA_MM3) {
+        fprintf(stderr, "Dados insuficientes para previsao.\n");
+        return;
+    }
+    fprintf(stderr, "\n--- Previsao (Dia %ld) ---\n", n + 1);
+    double mm3 = 0;
+    for (long i = n - JANELA_MM3; i < n; i++) mm3 += st->janela[i % JANELA_FLUXO].consumo;
+    fprintf(stderr, "Previsao MM3: %.2f kWh\n", mm3 / JANELA_MM3);
+
+    const AcumuladorCorrelacao* r = &st->regressao;
+    if (r->m2X != 0) {
+        double b1 = r->coMomento / r->m2X;
+        double b0 = r->mediaY - (b1 * r->mediaX);
+        fprintf(stderr, "Regressao Linear (Consumo ~ Irradiancia): y = %.2f + %.2f*x\n", b0, b1);
+    }
+}
+
+// Lê dias de um fluxo (stdin, pipe, tail -f) e emite cada dia tratado assim que
+// sua janela de outlier estiver completa. A memória usada é só a da janela.
+int processarFluxo(FILE* fp) {
+    static EstadoFluxo st;
+    char linha[MAX_LINHA];
+    PlanoLeitura plano;
+    RegistroEnergia reg;
+    Entrada entrada;
+
+    memset(&st, 0, sizeof(st));
+    iniciarQuantis(&st.quantisCons);
+    iniciarQuantis(&st.quantisImp);
+
+    // Fluxo compactado (ex.: cat arquivo.csv.gz | ConsumoDeEnergia -) também é aceito
+    if (!abrirEntrada(&entrada, fp)) return -1;
+
+    // Cabeçalho: define a ordem das colunas
+    if (lerLinhaEntrada(&entrada, linha, MAX_LINHA) == NULL) {
+        fecharEntrada(&entrada);
+        return 0;
+    }
+    if (!montarPlano(linha, &plano, stderr)) {
+        fecharEntrada(&entrada);
+        return -1;
+    }
+
+    printf("Dia;ConsumoTratado;ZScore;EhOutlier;Prev_MM3\n");
+    while (lerLinhaEntrada(&entrada, linha, MAX_LINHA) != NULL) {
+        if (interpretarLinha(&plano, linha, &reg)) {
+            receberFluxo(&st, &reg);
+        }
+    }
+    fecharEntrada(&entrada);
+
+    // Fim do fluxo: emitir os dias que aguardavam a janela futura
+    while (st.emitidos < st.lidos) {
+        emitirFluxo(&st);
+    }
+
+    resumirFluxo(&st);
+    return (int)st.lidos;
+}
+
+// --- Modo Servidor (socket Unix) ---
+#ifndef _WIN32
+
+// Estado do servidor: dados brutos + tratados mantidos em memória
+typedef struct {
+    const char* arquivo;
+    long offset;                      // Posição no arquivo após a última linha completa
+    PlanoLeitura plano;               // Montado a partir do cabeçalho na primeira leitura
+    int n;
+
+    // Arquivo como estava na última leitura: crescer só é anexo se for o mesmo
+    // arquivo (dispositivo/inode) e o início já lido não mudou
+    dev_t dispositivo;
+    ino_t inode;
+    time_t modificado;                // st_mtime (pega reescrita com o mesmo tamanho)
+    size_t tamPrefixo;
+    char prefixo[MAX_LINHA];          // Primeiros bytes: cabeçalho + primeiras linhas
+
+    RegistroEnergia brutos[MAX_DIAS]; // Como lidos do CSV (base para re-tratar)
+    RegistroEnergia dados[MAX_DIAS];  // Tratados (consultados pelos clientes)
+    Momentos momentos;                // Dos dados tratados, refeitos a cada atualização
+    ModeloLinear modelo;
+} EstadoServidor;
+
+typedef struct {
+    int fd;
+    size_t usados;
+    char buffer[MAX_LINHA];
+} ClienteServidor;
+
+// Lê apenas as linhas completas adicionadas desde *offset.
+// Retorna quantos registros novos foram anexados, ou -1 se o arquivo não abriu.
+int lerNovasLinhas(const char* nomeArquivo, long* offset, PlanoLeitura* plano, RegistroEnergia dados[], int n, int maxRegistros) {
+    FILE* fp = fopen(nomeArquivo, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    char linha[MAX_LINHA];
+    int novos = 0;
+
+    if (fseek(fp, *offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    while (n + novos < maxRegistros && fgets(linha, MAX_LINHA, fp) != NULL) {
+        size_t len = strlen(linha);
+        if (len == 0 || linha[len - 1] != '\n') break; // Linha ainda sendo escrita
+        long inicioLinha = *offset;
+        *offset = ftell(fp);
+        if (inicioLinha == 0) {
+            // Cabeçalho
+            if (!montarPlano(linha, plano, stdout)) {
+                fclose(fp);
+                return -1;
+            }
+            continue;
+        }
+        if (interpretarLinha(plano, linha, &dados[n + novos])) {
+            novos++;
+        }
+    }
+
+    fclose(fp);
+    return novos;
+}
+
+// Lê até 'max' bytes do início do arquivo. Retorna quantos foram lidos.
+static size_t lerPrefixoArquivo(const char* nomeArquivo, char* buffer, size_t max) {
+    FILE* fp = fopen(nomeArquivo, "rb");
+    if (fp == NULL) return 0;
+    size_t lidos = fread(buffer, 1, max, fp);
+    fclose(fp);
+    return lidos;
+}
+
+// Decide se o arquivo foi reescrito desde a última leitura (e não só anexado)
+static int arquivoReescrito(const EstadoServidor* srv, const struct stat* info) {
+    if (srv->offset == 0) return 0; // Nada lido ainda
+    if (info->st_dev != srv->dispositivo || info->st_ino != srv->inode) return 1; // Trocado (ex.: rename)
+    if ((long)info->st_size < srv->offset) return 1; // Truncado
+    if ((long)info->st_size == srv->offset) return info->st_mtime != srv->modificado;
+
+    // Cresceu: só é anexo se o cabeçalho e as primeiras linhas continuam iguais
+    char atual[MAX_LINHA];
+    size_t lidos = lerPrefixoArquivo(srv->arquivo, atual, srv->tamPrefixo);
+    return lidos != srv->tamPrefixo || memcmp(atual, srv->prefixo, lidos) != 0;
+}
+
+// Verifica se o arquivo cresceu; se sim, anexa e re-trata. Retorna 1 se houve mudança.
+int atualizarServidor(EstadoServidor* srv) {
+    struct stat info;
+    if (stat(srv->arquivo, &info) != 0) return 0;
+
+    if (arquivoReescrito(srv, &info)) {
+        // Arquivo truncado/reescrito/trocado: recarregar do início
+        printf("Arquivo '%s' reescrito. Recarregando...\n", srv->arquivo);
+        srv->offset = 0;
+        srv->n = 0;
+    } else if ((long)info.st_size == srv->offset) {
+        return 0;
+    }
+
+    int novos = lerNovasLinhas(srv->arquivo, &srv->offset, &srv->plano, srv->brutos, srv->n, MAX_DIAS);
+    srv->dispositivo = info.st_dev;
+    srv->inode = info.st_ino;
+    srv->modificado = info.st_mtime;
+    size_t maxPrefixo = (srv->offset > 0 && (size_t)srv->offset < sizeof(srv->prefixo)) ? (size_t)srv->offset : sizeof(srv->prefixo);
+    srv->tamPrefixo = (srv->offset > 0) ? lerPrefixoArquivo(srv->arquivo, srv->prefixo, maxPrefixo) : 0;
+    if (novos <= 0 && srv->n > 0) return 0;
+    if (novos > 0) srv->n += novos;
+
+    // O tratamento depende da média global: re-tratar a partir dos brutos
+    int contagem[NUM_CAMPOS];
+    TabelaDados tabela = {srv->dados, NULL, srv->n, 0, 0};
+    memcpy(srv->dados, srv->brutos, sizeof(RegistroEnergia) * srv->n);
+    imputarDados(&tabela, IMPUTA_LINEAR, contagem);
+    tratarDados(&tabela);
+    calcularMomentos(&tabela, &srv->momentos);
+    ajustarModelo(&srv->momentos, &srv->modelo);
+    printf("Dados atualizados: %d dias (+%d).\n", srv->n, novos > 0 ? novos : 0);
+    fflush(stdout);
+    return 1;
+}
+
+// Responde a um comando do protocolo de linha. Sempre termina com '\n'.
+void responderConsulta(const EstadoServidor* srv, char* comando, char* resp, size_t tam) {
+    RegistroEnergia* dados = (RegistroEnergia*)srv->dados;
+    int n = srv->n;
+    TabelaDados tabela = {dados, NULL, n, 0, 0};
+    char nome[32];
+    int diaIni, diaFim;
+    double colA[MAX_DIAS], colB[MAX_DIAS], colC[MAX_DIAS];
+
+    comando[strcspn(comando, "\r\n")] = '\0';
+
+    if (strcmp(comando, "PING") == 0) {
+        snprintf(resp, tam, "OK\n");
+    } else if (n == 0) {
+        snprintf(resp, tam, "ERRO sem dados\n");
+    } else if (strcmp(comando, "STATS") == 0) {
+        double minCons = dados[0].consumo, maxCons = dados[0].consumo;
+        for (int i = 0; i < n; i++) {
+            if (dados[i].consumo < minCons) minCons = dados[i].consumo;
+            if (dados[i].consumo > maxCons) maxCons = dados[i].consumo;
+        }
+        const Momentos* m = &srv->momentos;
+        snprintf(resp, tam, "OK n=%d consumo_media=%.2f consumo_min=%.2f consumo_max=%.2f fv_media=%.2f importacao_media=%.2f\n",
+                 n, m->mediaConsumo, minCons, maxCons, m->mediaGeracaoFV, m->mediaImportacao);
+    } else if (sscanf(comando, "CORR %31s", nome) == 1) {
+        if (strcmp(nome, "temp") && strcmp(nome, "umidade") && strcmp(nome, "ocupacao") &&
+            strcmp(nome, "irradiancia") && strcmp(nome, "diaUtil")) {
+            snprintf(resp, tam, "ERRO variavel desconhecida: %s\n", nome);
+        } else {
+            snprintf(resp, tam, "OK %.4f\n", calcularCorrelacao(&tabela, &srv->momentos, nome));
+        }
+    } else if (sscanf(comando, "RANGE %d %d", &diaIni, &diaFim) == 2) {
+        double minC = 0, maxC = 0;
+        int count = 0;
+        for (int i = 0; i < n; i++) {
+            if (dados[i].dia < diaIni || dados[i].dia > diaFim) continue;
+            if (count == 0 || dados[i].consumo < minC) minC = dados[i].consumo;
+            if (count == 0 || dados[i].consumo > maxC) maxC = dados[i].consumo;
+            colA[count++] = dados[i].consumo;
+        }
+        if (count == 0) snprintf(resp, tam, "ERRO nenhum dia no intervalo\n");
+        else snprintf(resp, tam, "OK n=%d media=%.2f min=%.2f max=%.2f\n", count, mediaDeterministica(colA, count), minC, maxC);
+    } else if (strcmp(comando, "CUSTO") == 0) {
+        extrairColuna(&tabela, "custoRede", colA);
+        extrairColuna(&tabela, "custoVE", colB);
+        extrairColuna(&tabela, "economiaFV", colC);
+        snprintf(resp, tam, "OK rede=%.2f ve=%.2f economia_fv=%.2f\n", reduzirSoma(colA, n), reduzirSoma(colB, n), reduzirSoma(colC, n));
+    } else if (strcmp(comando, "PREV") == 0) {
+        if (n < JANELA_MM3) {
+            snprintf(resp, tam, "ERRO dados insuficientes\n");
+            return;
+        }
+        double mm3 = 0;
+        for (int i = n - JANELA_MM3; i < n; i++) mm3 += dados[i].consumo;
+        mm3 /= JANELA_MM3;
+
+        snprintf(resp, tam, "OK dia=%d mm3=%.2f b0=%.2f b1=%.2f\n", dados[n-1].dia + 1, mm3, srv->modelo.b0, srv->modelo.b1);
+    } else {
+        snprintf(resp, tam, "ERRO comando desconhecido (use PING, STATS, CORR <var>, RANGE <ini> <fim>, CUSTO, PREV)\n");
+    }
+}
+
+// Carrega e trata os dados uma vez, observa o arquivo e responde consultas no socket.
+// SIGINT/SIGTERM só pedem a parada; o laço sai e fecha/remove o socket
+static volatile sig_atomic_t servidorAtivo;
+
+static void pararServidor(int sinal) {
+    (void)sinal;
+    servidorAtivo = 0;
+}
+
+int executarServidor(const char* arquivo, const char* caminhoSocket) {
+    static EstadoServidor srv;
+    ClienteServidor clientes[MAX_CLIENTES];
+    struct pollfd fds[MAX_CLIENTES + 1];
+    int nClientes = 0;
+
+    memset(&srv, 0, sizeof(srv));
+    srv.arquivo = arquivo;
+    atualizarServidor(&srv);
+    if (srv.n <= 0) {
+        printf("Erro: Nao foi possivel ler dados ou arquivo vazio.\n");
+        return 1;
+    }
+
+    int servidor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (servidor < 0) {
+        perror("Erro ao criar socket");
+        return 1;
+    }
+    struct sockaddr_un endereco;
+    memset(&endereco, 0, sizeof(endereco));
+    endereco.sun_family = AF_UNIX;
+    strncpy(endereco.sun_path, caminhoSocket, sizeof(endereco.sun_path) - 1);
+    unlink(caminhoSocket);
+    if (bind(servidor, (struct sockaddr*)&endereco, sizeof(endereco)) != 0 || listen(servidor, MAX_CLIENTES) != 0) {
+        perror("Erro ao abrir socket");
+        close(servidor);
+        return 1;
+    }
+    // Sem SA_RESTART: o sinal interrompe o poll na hora
+    struct sigaction acao;
+    memset(&acao, 0, sizeof(acao));
+    acao.sa_handler = pararServidor;
+    sigemptyset(&acao.sa_mask);
+    servidorAtivo = 1;
+    sigaction(SIGINT, &acao, NULL);
+    sigaction(SIGTERM, &acao, NULL);
+
+    printf("Servidor pronto em '%s' (%d dias em memoria).\n", caminhoSocket, srv.n);
+    fflush(stdout);
+
+    int erro = 0;
+    while (servidorAtivo) {
+        fds[0].fd = servidor;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < nClientes; i++) {
+            fds[i + 1].fd = clientes[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        int prontos = poll(fds, nClientes + 1, INTERVALO_OBSERVACAO_MS);
+        if (prontos < 0) {
+            if (errno == EINTR) continue;
+            perror("Erro no poll");
+            erro = 1;
+            break;
+        }
+        if (prontos == 0) {
+            atualizarServidor(&srv);
+            continue;
+        }
+
+        // Clientes (de trás para frente para poder remover)
+        for (int i = nClientes - 1; i >= 0; i--) {
+            if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ClienteServidor* c = &clientes[i];
+            ssize_t lidos = read(c->fd, c->buffer + c->usados, sizeof(c->buffer) - 1 - c->usados);
+            int fechar = (lidos <= 0);
+            if (lidos > 0) {
+                c->usados += (size_t)lidos;
+                c->buffer[c->usados] = '\0';
+
+                char* inicio = c->buffer;
+                char* fim;
+                while ((fim = strchr(inicio, '\n')) != NULL) {
+                    char resp[MAX_LINHA];
+                    *fim = '\0';
+                    if (strncmp(inicio, "QUIT", 4) == 0) { fechar = 1; break; }
+                    responderConsulta(&srv, inicio, resp, sizeof(resp));
+                    if (send(c->fd, resp, strlen(resp), MSG_NOSIGNAL) < 0) { fechar = 1; break; }
+                    inicio = fim + 1;
+                }
+                c->usados = strlen(inicio);
+                memmove(c->buffer, inicio, c->usados + 1);
+                if (c->usados == sizeof(c->buffer) - 1) fechar = 1; // Linha grande demais
+            }
+            if (fechar) {
+                close(c->fd);
+                clientes[i] = clientes[--nClientes];
+            }
+        }
+
+        // Nova conexão
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(servidor, NULL, NULL);
+            if (fd >= 0) {
+                if (nClientes < MAX_CLIENTES) {
+                    clientes[nClientes].fd = fd;
+                    clientes[nClientes].usados = 0;
+                    nClientes++;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+
+        atualizarServidor(&srv);
+    }
+
+    for (int i = 0; i < nClientes; i++) close(clientes[i].fd);
+    close(servidor);
+    unlink(caminhoSocket);
+    if (!erro) printf("Servidor encerrado.\n");
+    return erro;
+}
+
+#else
+
+int executarServidor(const char* arquivo, const char* caminhoSocket) {
+    (void)arquivo; (void)caminhoSocket;
+    printf("Erro: Modo servidor disponivel apenas em sistemas POSIX.\n");
+    return 1;
+}
+
+#endif
+
+// --- Simulador de Cenários (bateria / deslocamento do VE) ---
+// Balanço diário: a geração FV atende primeiro a demanda do dia (consumo + VE);
+// o excedente carrega a bateria (perdas aplicadas na carga) e a bateria cobre o
+// déficit dos dias seguintes. A granularidade diária não captura o ciclo dia/noite.
+
+// Escolhe o dia em [d, d+JANELA_VE] que recebe a recarga do dia d
+static int destinoVE(const RegistroEnergia dados[], int n, int d, int politica, double escalaFV) {
+    int melhor = d;
+    for (int j = d + 1; j <= d + JANELA_VE && j < n; j++) {
+        if (politica == VE_EXCEDENTE_FV) {
+            double sobraJ = dados[j].geracaoFV * escalaFV - dados[j].consumo;
+            double sobraM = dados[melhor].geracaoFV * escalaFV - dados[melhor].consumo;
+            if (sobraJ > sobraM) melhor = j;
+        } else if (politica == VE_TARIFA_MENOR) {
+            if (dados[j].tarifaPonta < dados[melhor].tarifaPonta) melhor = j;
+        }
+    }
+    return melhor;
+}
+
+// Reproduz o histórico sob um cenário. Só lê os dados (compartilhados entre threads).
+void simularCenario(const RegistroEnergia dados[], int n, CenarioSimulacao* c) {
+    double ve[MAX_DIAS];
+    for (int d = 0; d < n; d++) ve[d] = 0;
+    for (int d = 0; d < n; d++) {
+        int alvo = (c->politicaVE == VE_ORIGINAL) ? d : destinoVE(dados, n, d, c->politicaVE, c->escalaFV);
+        ve[alvo] += dados[d].cargaVE;
+    }
+
+    double soc = 0, importacao = 0, custo = 0, geracao = 0, exportado = 0;
+    for (int d = 0; d < n; d++) {
+        double fv = dados[d].geracaoFV * c->escalaFV;
+        double demanda = dados[d].consumo + ve[d];
+        double direto = fmin(fv, demanda);
+        double sobra = fv - direto;
+        double deficit = demanda - direto;
+
+        // Carga da bateria com o excedente
+        double armazenado = fmin(sobra * c->eficiencia, c->capacidade - soc);
+        soc += armazenado;
+        exportado += sobra - (c->eficiencia > 0 ? armazenado / c->eficiencia : 0);
+
+        // Descarga para o déficit
+        double descarga = fmin(soc, deficit);
+        soc -= descarga;
+        deficit -= descarga;
+
+        importacao += deficit;
+        custo += deficit * dados[d].tarifaPonta;
+        geracao += fv;
+    }
+
+    c->importacao = importacao;
+    c->custo = custo;
+    c->autoconsumo = (geracao > 0) ? (geracao - exportado) / geracao : 0;
+}
+
+typedef struct {
+    const RegistroEnergia* dados;
+    int n;
+    CenarioSimulacao* cenarios;
+    int nCenarios;
+    int inicio, passo;
+} TarefaSimulacao;
+
+static void* trabalhadorSimulacao(void* arg) {
+    TarefaSimulacao* t = (TarefaSimulacao*)arg;
+    for (int i = t->inicio; i < t->nCenarios; i += t->passo) {
+        simularCenario(t->dados, t->n, &t->cenarios[i]);
+    }
+    return NULL;
+}
+
+int numeroNucleos(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+    return (nucleos > 0) ? (int)nucleos : 1;
+#endif
+}
+
+static int compararCusto(const void* a, const void* b) {
+    const CenarioSimulacao* x = (const CenarioSimulacao*)a;
+    const CenarioSimulacao* y = (const CenarioSimulacao*)b;
+    if (x->custo < y->custo) return -1;
+    if (x->custo > y->custo) return 1;
+    return 0;
+}
+
+// Varre todas as combinações de cenários em paralelo e exporta os resultados
+void simularCenarios(const RegistroEnergia dados[], int n, int nThreads, const char* arquivoSaida) {
+    static const double eficiencias[] = {0.80, 0.85, 0.90, 0.95};
+    static const double escalasFV[] = {1.0, 1.5, 2.0, 2.5, 3.0};
+    static const char* nomesPolitica[] = {"original", "excedenteFV", "tarifaMenor"};
+    int nCap = (int)(CAPACIDADE_MAX / PASSO_CAPACIDADE) + 1;
+    int nEf = sizeof(eficiencias) / sizeof(eficiencias[0]);
+    int nEsc = sizeof(escalasFV) / sizeof(escalasFV[0]);
+    int nPol = sizeof(nomesPolitica) / sizeof(nomesPolitica[0]);
+
+    int nCenarios = nCap * nEf * nEsc * nPol;
+    CenarioSimulacao* cenarios = malloc(sizeof(CenarioSimulacao) * nCenarios);
+    if (cenarios == NULL) {
+        printf("Erro: Memoria insuficiente para a simulacao.\n");
+        return;
+    }
+
+    int k = 0;
+    for (int a = 0; a < nCap; a++)
+        for (int b = 0; b < nEf; b++)
+            for (int e = 0; e < nEsc; e++)
+                for (int p = 0; p < nPol; p++) {
+                    memset(&cenarios[k], 0, sizeof(CenarioSimulacao));
+                    cenarios[k].capacidade = a * PASSO_CAPACIDADE;
+                    cenarios[k].eficiencia = eficiencias[b];
+                    cenarios[k].escalaFV = escalasFV[e];
+                    cenarios[k].politicaVE = p;
+                    k++;
+                }
+
+    if (nThreads < 1) nThreads = numeroNucleos();
+    if (nThreads > MAX_THREADS) nThreads = MAX_THREADS;
+    if (nThreads > nCenarios) nThreads = nCenarios;
+
+    printf("\n--- Simulacao de Cenarios (%d cenarios, %d threads) ---\n", nCenarios, nThreads);
+
+    pthread_t threads[MAX_THREADS];
+    TarefaSimulacao tarefas[MAX_THREADS];
+    int criadas[MAX_THREADS] = {0};
+    for (int t = 0; t < nThreads; t++) {
+        tarefas[t] = (TarefaSimulacao){dados, n, cenarios, nCenarios, t, nThreads};
+        if (t > 0) {
+            if (pthread_create(&threads[t], NULL, trabalhadorSimulacao, &tarefas[t]) == 0) criadas[t] = 1;
+            else trabalhadorSimulacao(&tarefas[t]); // Sem thread extra: fatia roda na principal
+        }
+    }
+    trabalhadorSimulacao(&tarefas[0]);
+    for (int t = 1; t < nThreads; t++) {
+        if (criadas[t]) pthread_join(threads[t], NULL);
+    }
+
+    // Referência: histórico real
+    double importacaoReal = 0, custoReal = 0;
+    for (int d = 0; d < n; d++) {
+        importacaoReal += dados[d].importacaoRede;
+        custoReal += dados[d].importacaoRede * dados[d].tarifaPonta;
+    }
+    printf("Historico real: Importacao=%.0f kWh  Custo=R$ %.2f\n", importacaoReal, custoReal);
+
+    FILE* f = fopen(arquivoSaida, "w");
+    if (f != NULL) {
+        fprintf(f, "Capacidade;Eficiencia;EscalaFV;PoliticaVE;Importacao;Autoconsumo;Custo\n");
+        for (int i = 0; i < nCenarios; i++) {
+            fprintf(f, "%.0f;%.2f;%.1f;%s;%.0f;%.4f;%.2f\n", cenarios[i].capacidade, cenarios[i].eficiencia,
+                    cenarios[i].escalaFV, nomesPolitica[cenarios[i].politicaVE],
+                    cenarios[i].importacao, cenarios[i].autoconsumo, cenarios[i].custo);
+        }
+        fclose(f);
+        printf("Resultados de todos os cenarios em '%s'.\n", arquivoSaida);
+    } else {
+        printf("Erro ao criar arquivo '%s'.\n", arquivoSaida);
+    }
+
+    qsort(cenarios, nCenarios, sizeof(CenarioSimulacao), compararCusto);
+    printf("\nMelhores cenarios (menor custo):\n");
+    printf("  %10s %6s %6s %-12s %12s %8s %14s\n", "Bateria", "Efic.", "FVx", "VE", "Importacao", "Autocons", "Custo (R$)");
+    for (int i = 0; i < nCenarios && i < TOP_CENARIOS; i++) {
+        printf("  %10.0f %6.2f %6.1f %-12s %12.0f %7.1f%% %14.2f\n", cenarios[i].capacidade, cenarios[i].eficiencia,
+               cenarios[i].escalaFV, nomesPolitica[cenarios[i].politicaVE],
+               cenarios[i].importacao, 100.0 * cenarios[i].autoconsumo, cenarios[i].custo);
+    }
+
+    free(cenarios);
+}
+
+// --- Anomalias da Frota (vários medidores) ---
+// O Z-score de tratarDados compara o medidor com o próprio histórico. Aqui cada
+// dia é comparado entre os medidores: o consumo é normalizado pela mediana do
+// medidor, uma regressão global desconta clima/ocupação/dia útil, e o resíduo
+// de cada medidor é medido contra a mediana e o MAD dos pares naquele dia.
+enum { FASE_MEDIDORES, FASE_RESIDUOS, FASE_DIAS, FASE_ESCORES };
+
+typedef struct {
+    Frota* frota;
+    int fase;
+    int inicio, passo;
+} TarefaFrota;
+
+// Seleção do k-ésimo menor (quickselect, tempo linear em média); reordena v
+static double selecionarK(double v[], int n, int k) {
+    int ini = 0, fim = n - 1;
+    while (ini < fim) {
+        double pivo = v[ini + (fim - ini) / 2];
+        int i = ini, j = fim;
+        while (i <= j) {
+            while (v[i] < pivo) i++;
+            while (v[j] > pivo) j--;
+            if (i <= j) {
+                double t = v[i]; v[i] = v[j]; v[j] = t;
+                i++; j--;
+            }
+        }
+        if (k <= j) fim = j;
+        else if (k >= i) ini = i;
+        else break;
+    }
+    return v[k];
+}
+
+// Mediana sem ordenar (reordena v)
+double medianaVetor(double v[], int n) {
+    if (n <= 0) return 0;
+    double alta = selecionarK(v, n, n / 2);
+    if (n % 2 == 1) return alta;
+    double baixa = v[0]; // v[0..n/2) <= alta: o maior deles é o outro central
+    for (int i = 1; i < n / 2; i++) if (v[i] > baixa) baixa = v[i];
+    return (baixa + alta) / 2.0;
+}
+
+static void regressoresFrota(const RegistroEnergia* reg, double x[NUM_REGRESSORES]) {
+    x[0] = 1.0;
+    x[1] = reg->temp;
+    x[2] = reg->ocupacao;
+    x[3] = reg->diaUtil;
+}
+
+// Resolve A x = b (eliminação de Gauss com pivô parcial). Retorna 0 se singular.
+static int resolverSistema(double a[NUM_REGRESSORES][NUM_REGRESSORES], double b[NUM_REGRESSORES], double x[NUM_REGRESSORES]) {
+    for (int c = 0; c < NUM_REGRESSORES; c++) {
+        int pivo = c;
+        for (int l = c + 1; l < NUM_REGRESSORES; l++) if (fabs(a[l][c]) > fabs(a[pivo][c])) pivo = l;
+        if (fabs(a[pivo][c]) < 1e-12) return 0;
+        if (pivo != c) {
+            for (int k = 0; k < NUM_REGRESSORES; k++) { double t = a[c][k]; a[c][k] = a[pivo][k]; a[pivo][k] = t; }
+            double t = b[c]; b[c] = b[pivo]; b[pivo] = t;
+        }
+        for (int l = c + 1; l < NUM_REGRESSORES; l++) {
+            double f = a[l][c] / a[c][c];
+            for (int k = c; k < NUM_REGRESSORES; k++) a[l][k] -= f * a[c][k];
+            b[l] -= f * b[c];
+        }
+    }
+    for (int c = NUM_REGRESSORES - 1; c >= 0; c--) {
+        double soma = b[c];
+        for (int k = c + 1; k < NUM_REGRESSORES; k++) soma -= a[c][k] * x[k];
+        x[c] = soma / a[c][c];
+    }
+    return 1;
+}
+
+// Fase 1 (por medidor): mediana, percentis e parciais X'X, X'y. Os esboços do
+// medidor ('locais') dão os percentis dele e depois entram nos do grupo.
+static void processarMedidor(MedidorFrota* m, EsbocoQuantis* grupoCons, EsbocoQuantis* grupoImp,
+                             EsbocoQuantis locais[2], double* buffer) {
+    iniciarQuantis(&locais[0]);
+    iniciarQuantis(&locais[1]);
+    for (int i = 0; i < m->n; i++) {
+        buffer[i] = m->dados[i].consumo;
+        inserirQuantil(&locais[0], m->dados[i].consumo);
+        inserirQuantil(&locais[1], m->dados[i].importacaoRede);
+    }
+    calcularQuantis(&locais[0], PERCENTIS, 3, m->percentisCons);
+    calcularQuantis(&locais[1], PERCENTIS, 3, m->percentisImp);
+    combinarQuantis(grupoCons, &locais[0]);
+    combinarQuantis(grupoImp, &locais[1]);
+
+    m->mediana = medianaVetor(buffer, m->n);
+    memset(m->xtx, 0, sizeof(m->xtx));
+    memset(m->xty, 0, sizeof(m->xty));
+    if (m->mediana <= 0) return; // Medidor sem consumo: fica fora do modelo
+
+    for (int i = 0; i < m->n; i++) {
+        double x[NUM_REGRESSORES], y = m->dados[i].consumo / m->mediana;
+        regressoresFrota(&m->dados[i], x);
+        for (int a = 0; a < NUM_REGRESSORES; a++) {
+            for (int b = 0; b < NUM_REGRESSORES; b++) m->xtx[a][b] += x[a] * x[b];
+            m->xty[a] += x[a] * y;
+        }
+    }
+}
+
+// Fase 2 (por medidor): resíduo normalizado de cada dia na matriz. A coluna vem
+// da data; dia repetido fica com a primeira leitura.
+static void residuosMedidor(Frota* f, int medidor) {
+    MedidorFrota* m = &f->medidores[medidor];
+    double* linha = &f->residuos[(size_t)medidor * f->nDias];
+    if (m->mediana <= 0) return;
+
+    for (int i = 0; i < m->n; i++) {
+        long data;
+        if (!converterData(m->dados[i].data, &data)) { m->semData++; continue; }
+        long d = data - f->inicio;
+        if (d < 0 || d >= f->nDias) { m->foraMatriz++; continue; }
+        if (!isnan(linha[d])) { m->repetidos++; continue; }
+        double x[NUM_REGRESSORES], previsto = 0;
+        regressoresFrota(&m->dados[i], x);
+        for (int a = 0; a < NUM_REGRESSORES; a++) previsto += f->beta[a] * x[a];
+        linha[d] = m->dados[i].consumo / m->mediana - previsto;
+    }
+}
+
+// Fase 3 (por dia): mediana e MAD dos resíduos dos medidores naquele dia
+static void compararDia(Frota* f, int d, double* buffer) {
+    int k = 0;
+    f->madDia[d] = NAN;
+    for (int m = 0; m < f->nMedidores; m++) {
+        double r = f->residuos[(size_t)m * f->nDias + d];
+        if (!isnan(r)) buffer[k++] = r;
+    }
+    if (k < MIN_MEDIDORES_DIA) return;
+
+    f->medianaDia[d] = medianaVetor(buffer, k);
+    for (int i = 0; i < k; i++) buffer[i] = fabs(buffer[i] - f->medianaDia[d]);
+    f->madDia[d] = medianaVetor(buffer, k);
+}
+
+// Fase 4 (por dia): z robusto. Com poucos pares o MAD do dia pode sair perto de
+// zero por acaso; o piso relativo ao MAD típico evita marcar ruído como anomalia.
+static void escoresDia(Frota* f, int d) {
+    if (isnan(f->madDia[d])) return;
+    double mad = fmax(f->madDia[d], MAD_PISO_RELATIVO * f->madTipico);
+    if (mad <= 0) return;
+
+    for (int m = 0; m < f->nMedidores; m++) {
+        size_t idx = (size_t)m * f->nDias + d;
+        if (!isnan(f->residuos[idx])) f->zRobusto[idx] = 0.6745 * (f->residuos[idx] - f->medianaDia[d]) / mad;
+    }
+}
+
+static void* trabalhadorFrota(void* arg) {
+    TarefaFrota* t = (TarefaFrota*)arg;
+    Frota* f = t->frota;
+    int tam = (f->nMedidores > MAX_DIAS) ? f->nMedidores : MAX_DIAS;
+    int comBuffer = (t->fase == FASE_MEDIDORES || t->fase == FASE_DIAS);
+    double* buffer = comBuffer ? (double*)malloc(sizeof(double) * tam) : NULL;
+    EsbocoQuantis* locais = (t->fase == FASE_MEDIDORES) ? (EsbocoQuantis*)malloc(sizeof(EsbocoQuantis) * 2) : NULL;
+    if ((comBuffer && buffer == NULL) || (t->fase == FASE_MEDIDORES && locais == NULL)) {
+        free(buffer);
+        free(locais);
+        return NULL;
+    }
+
+    if (t->fase == FASE_ESCORES) {
+        for (int d = t->inicio; d < f->nDias; d += t->passo) escoresDia(f, d);
+    } else if (t->fase == FASE_DIAS) {
+        for (int d = t->inicio; d < f->nDias; d += t->passo) compararDia(f, d, buffer);
+    } else if (t->fase == FASE_MEDIDORES) {
+        for (int g = t->inicio; g < f->nGrupos; g += t->passo) {
+            for (int m = g; m < f->nMedidores; m += f->nGrupos) {
+                processarMedidor(&f->medidores[m], &f->quantisCons[g], &f->quantisImp[g], locais, buffer);
+            }
+        }
+    } else {
+        for (int m = t->inicio; m < f->nMedidores; m += t->passo) residuosMedidor(f, m);
+    }
+    free(buffer);
+    free(locais);
+    return NULL;
+}
+
+// Roda uma fase fatiada entre as threads (mesmo esquema do simulador). Cada
+// fase usa no máximo uma thread por unidade de trabalho (grupo, medidor ou dia).
+static void executarFaseFrota(Frota* f, int fase, int nThreads) {
+    int trabalho = (fase == FASE_MEDIDORES) ? f->nGrupos : (fase == FASE_RESIDUOS) ? f->nMedidores : f->nDias;
+    if (nThreads > trabalho) nThreads = trabalho;
+    if (nThreads < 1) return;
+    pthread_t threads[MAX_THREADS];
+    TarefaFrota tarefas[MAX_THREADS];
+    int criadas[MAX_THREADS] = {0};
+    for (int t = 0; t < nThreads; t++) {
+        tarefas[t] = (TarefaFrota){f, fase, t, nThreads};
+        if (t > 0) {
+            if (pthread_create(&threads[t], NULL, trabalhadorFrota, &tarefas[t]) == 0) criadas[t] = 1;
+            else trabalhadorFrota(&tarefas[t]);
+        }
+    }
+    trabalhadorFrota(&tarefas[0]);
+    for (int t = 1; t < nThreads; t++) {
+        if (criadas[t]) pthread_join(threads[t], NULL);
+    }
+}
+
+typedef struct {
+    int medidor, dia;
+    double z;
+} AnomaliaFrota;
+
+static int compararAnomalia(const void* a, const void* b) {
+    double x = fabs(((const AnomaliaFrota*)a)->z), y = fabs(((const AnomaliaFrota*)b)->z);
+    return (x < y) - (x > y); // Maior |z| primeiro
+}
+
+int analisarFrota(char* arquivos[], int nArquivos, int nThreads) {
+    static Frota f;
+    int erro = 1;
+
+    memset(&f, 0, sizeof(f));
+    f.medidores = (MedidorFrota*)calloc(nArquivos, sizeof(MedidorFrota));
+    if (f.medidores == NULL) {
+        printf("Erro: Memoria insuficiente para a frota.\n");
+        return 1;
+    }
+
+    // Leitura (cada arquivo é um medidor)
+    long ultima = 0;
+    int comData = 0;
+    for (int i = 0; i < nArquivos; i++) {
+        MedidorFrota* m = &f.medidores[f.nMedidores];
+        int contagem[NUM_CAMPOS];
+        m->arquivo = arquivos[i];
+        m->dados = (RegistroEnergia*)malloc(sizeof(RegistroEnergia) * MAX_DIAS);
+        if (m->dados == NULL) break;
+        m->n = lerCSV(arquivos[i], m->dados, MAX_DIAS);
+        if (m->n <= 0) {
+            printf("Aviso: '%s' ignorado (sem dados validos).\n", arquivos[i]);
+            free(m->dados);
+            continue;
+        }
+        TabelaDados tabela = {m->dados, NULL, m->n, 0, 0};
+        imputarDados(&tabela, IMPUTA_LINEAR, contagem);
+        for (int k = 0; k < m->n; k++) {
+            long data;
+            if (!converterData(m->dados[k].data, &data)) continue;
+            if (!comData || data < f.inicio) f.inicio = data;
+            if (!comData || data > ultima) ultima = data;
+            comData = 1;
+        }
+        f.nMedidores++;
+    }
+    if (f.nMedidores < MIN_MEDIDORES_DIA) {
+        printf("Erro: A analise de frota precisa de pelo menos %d medidores validos.\n", MIN_MEDIDORES_DIA);
+        goto fim;
+    }
+    if (!comData) {
+        printf("Erro: Nenhuma data valida nos arquivos da frota.\n");
+        goto fim;
+    }
+    // Um medidor guarda no máximo MAX_DIAS dias; o que passar disso fica fora da matriz
+    f.nDias = (ultima - f.inicio + 1 < MAX_DIAS) ? (int)(ultima - f.inicio + 1) : MAX_DIAS;
+
+    size_t celulas = (size_t)f.nMedidores * f.nDias;
+    f.residuos = (double*)malloc(sizeof(double) * celulas);
+    f.zRobusto = (double*)malloc(sizeof(double) * celulas);
+    f.medianaDia = (double*)malloc(sizeof(double) * f.nDias);
+    f.madDia = (double*)malloc(sizeof(double) * f.nDias);
+    if (f.residuos == NULL || f.zRobusto == NULL || f.medianaDia == NULL || f.madDia == NULL) {
+        printf("Erro: Memoria insuficiente para a frota.\n");
+        goto fim;
+    }
+    for (size_t c = 0; c < celulas; c++) {
+        f.residuos[c] = NAN;
+        f.zRobusto[c] = 0;
+    }
+
+    if (nThreads < 1) nThreads = numeroNucleos();
+    if (nThreads > MAX_THREADS) nThreads = MAX_THREADS;
+    f.nGrupos = (f.nMedidores < MAX_THREADS) ? f.nMedidores : MAX_THREADS;
+    for (int g = 0; g < f.nGrupos; g++) {
+        iniciarQuantis(&f.quantisCons[g]);
+        iniciarQuantis(&f.quantisImp[g]);
+    }
+
+    printf("\n--- Anomalias da Frota (%d medidores, %d dias, %d threads) ---\n", f.nMedidores, f.nDias, nThreads);
+
+    // 1. Por medidor: mediana e parciais da regressão
+    executarFaseFrota(&f, FASE_MEDIDORES, nThreads);
+
+    // 2. Regressão global, somando as parciais sempre na ordem dos medidores
+    double xtx[NUM_REGRESSORES][NUM_REGRESSORES] = {{0}}, xty[NUM_REGRESSORES] = {0};
+    for (int i = 0; i < f.nMedidores; i++) {
+        for (int a = 0; a < NUM_REGRESSORES; a++) {
+            for (int b = 0; b < NUM_REGRESSORES; b++) xtx[a][b] += f.medidores[i].xtx[a][b];
+            xty[a] += f.medidores[i].xty[a];
+        }
+    }
+    if (!resolverSistema(xtx, xty, f.beta)) {
+        // Regressores constantes na frota: compara só o consumo normalizado
+        printf("Aviso: Regressao da frota singular; usando apenas a normalizacao pela mediana.\n");
+        memset(f.beta, 0, sizeof(f.beta));
+        f.beta[0] = 1.0;
+    }
+    printf("Modelo (consumo/mediana): y = %.4f + %.5f*temp + %.5f*ocupacao + %.4f*diaUtil\n",
+           f.beta[0], f.beta[1], f.beta[2], f.beta[3]);
+
+    // 3. Resíduos na matriz medidor x dia; 4. comparação robusta por dia
+    executarFaseFrota(&f, FASE_RESIDUOS, nThreads);
+    executarFaseFrota(&f, FASE_DIAS, nThreads);
+    double* mads = (double*)malloc(sizeof(double) * f.nDias);
+    int nMads = 0;
+    if (mads == NULL) {
+        printf("Erro: Memoria insuficiente para a frota.\n");
+        goto fim;
+    }
+    for (int d = 0; d < f.nDias; d++) if (!isnan(f.madDia[d])) mads[nMads++] = f.madDia[d];
+    f.madTipico = medianaVetor(mads, nMads);
+    free(mads);
+    executarFaseFrota(&f, FASE_ESCORES, nThreads);
+
+    // Percentis da frota: esboços dos grupos combinados em ordem
+    for (int g = 1; g < f.nGrupos; g++) {
+        combinarQuantis(&f.quantisCons[0], &f.quantisCons[g]);
+        combinarQuantis(&f.quantisImp[0], &f.quantisImp[g]);
+    }
+    double pc[3];
+    if (calcularQuantis(&f.quantisCons[0], PERCENTIS, 3, pc)) {
+        printf("Consumo da frota (kWh):    P50=%.2f  P95=%.2f  P99=%.2f\n", pc[0], pc[1], pc[2]);
+    }
+    if (calcularQuantis(&f.quantisImp[0], PERCENTIS, 3, pc)) {
+        printf("Importacao da frota (kWh): P50=%.2f  P95=%.2f  P99=%.2f\n", pc[0], pc[1], pc[2]);
+    }
+
+    int nAnomalias = 0;
+    for (size_t c = 0; c < celulas; c++) {
+        if (fabs(f.zRobusto[c]) > Z_ROBUSTO_LIMITE) nAnomalias++;
+    }
+    AnomaliaFrota* anomalias = (AnomaliaFrota*)malloc(sizeof(AnomaliaFrota) * (nAnomalias > 0 ? nAnomalias : 1));
+    if (anomalias == NULL) {
+        printf("Erro: Memoria insuficiente para a frota.\n");
+        goto fim;
+    }
+    int k = 0;
+    for (int m = 0; m < f.nMedidores; m++) {
+        for (int d = 0; d < f.nDias; d++) {
+            double z = f.zRobusto[(size_t)m * f.nDias + d];
+            if (fabs(z) > Z_ROBUSTO_LIMITE) {
+                anomalias[k++] = (AnomaliaFrota){m, d, z};
+                f.medidores[m].anomalias++;
+            }
+        }
+    }
+    qsort(anomalias, nAnomalias, sizeof(AnomaliaFrota), compararAnomalia);
+
+    printf("\nPor medidor:\n");
+    printf("  %-30s %5s %10s %9s %27s %27s\n", "Arquivo", "Dias", "Mediana", "Anomalias",
+           "Consumo P50/P95/P99", "Importacao P50/P95/P99");
+    for (int m = 0; m < f.nMedidores; m++) {
+        const MedidorFrota* med = &f.medidores[m];
+        printf("  %-30s %5d %10.2f %9d %9.1f%9.1f%9.1f %9.1f%9.1f%9.1f\n", med->arquivo, med->n,
+               med->mediana, med->anomalias, med->percentisCons[0], med->percentisCons[1], med->percentisCons[2],
+               med->percentisImp[0], med->percentisImp[1], med->percentisImp[2]);
+    }
+    for (int m = 0; m < f.nMedidores; m++) {
+        const MedidorFrota* med = &f.medidores[m];
+        if (med->semData + med->foraMatriz + med->repetidos == 0) continue;
+        printf("  Aviso: '%s': %d linhas sem data, %d fora da matriz, %d dias repetidos (mantida a primeira leitura).\n",
+               med->arquivo, med->semData, med->foraMatriz, med->repetidos);
+    }
+
+    printf("\n%d dias-medidor destoam dos pares (|z robusto| > %.1f)", nAnomalias, Z_ROBUSTO_LIMITE);
+    printf(nAnomalias > 0 ? "; maiores desvios:\n" : ".\n");
+    for (int i = 0; i < nAnomalias && i < TOP_ANOMALIAS; i++) {
+        const MedidorFrota* m = &f.medidores[anomalias[i].medidor];
+        char data[11];
+        formatarData(f.inicio + anomalias[i].dia, data);
+        const RegistroEnergia* reg = NULL;
+        for (int j = 0; j < m->n && reg == NULL; j++) if (strcmp(m->dados[j].data, data) == 0) reg = &m->dados[j];
+        printf("  %-30s Dia %3d %-10s Consumo=%8.2f  z=%6.2f\n", m->arquivo, reg ? reg->dia : 0, data,
+               reg ? reg->consumo : 0, anomalias[i].z);
+    }
+
+    FILE* saida = fopen("anomalias_frota.csv", "w");
+    if (saida != NULL) {
+        fprintf(saida, "Arquivo;Data;Residuo;ZRobusto\n");
+        for (int i = 0; i < nAnomalias; i++) {
+            size_t idx = (size_t)anomalias[i].medidor * f.nDias + anomalias[i].dia;
+            char data[11];
+            formatarData(f.inicio + anomalias[i].dia, data);
+            fprintf(saida, "%s;%s;%.4f;%.2f\n", f.medidores[anomalias[i].medidor].arquivo,
+                    data, f.residuos[idx], anomalias[i].z);
+        }
+        fclose(saida);
+        printf("Anomalias exportadas em 'anomalias_frota.csv'.\n");
+    } else {
+        printf("Erro ao criar arquivo 'anomalias_frota.csv'.\n");
+    }
+    free(anomalias);
+    erro = 0;
+
+fim:
+    for (int i = 0; i < f.nMedidores; i++) free(f.medidores[i].dados);
+    free(f.medidores);
+    free(f.residuos);
+    free(f.zRobusto);
+    free(f.medianaDia);
+    free(f.madDia);
+    return erro;
+}
+
+// --- Pipeline de Etapas ---
+// Cada etapa declara suas dependências; executarEtapa roda só o necessário
+// para as etapas pedidas e memoriza o que já foi feito (cada etapa roda uma vez).
+static void etapaLeitura(Pipeline* p) {
+    printf("Lendo arquivo '%s'...\n", p->arquivo);
+
+    TabelaDados* t = &p->tabela;
+    if (p->compacto) t->compacto = (RegistroCompacto*)malloc(sizeof(RegistroCompacto) * MAX_DIAS);
+    else t->completo = (RegistroEnergia*)malloc(sizeof(RegistroEnergia) * MAX_DIAS);
+    if (t->compacto == NULL && t->completo == NULL) {
+        printf("Erro: Memoria insuficiente.\n");
+        p->erro = 1;
+        return;
+    }
+
+    if (lerTabela(p->arquivo, t, MAX_DIAS) <= 0) {
+        printf("Erro: Nao foi possivel ler dados ou arquivo vazio.\n");
+        p->erro = 1;
+        return;
+    }
+    printf("Sucesso: %d dias lidos.\n", t->n);
+    if (p->compacto) {
+        printf("Armazenamento compacto: %zu bytes/dia (original %zu), erro maximo %.4f, %d saturados\n",
+               sizeof(RegistroCompacto), sizeof(RegistroEnergia), t->erroMaximo, t->saturados);
+    }
+}
+
+static const char* NOMES_IMPUTACAO[NUM_METODOS_IMPUTACAO] = {"linear", "ultimo", "mm3"};
+
+static void etapaImputacao(Pipeline* p) {
+    int contagem[NUM_CAMPOS];
+    int total = imputarDados(&p->tabela, p->imputacao, contagem);
+    if (total == 0) return;
+
+    printf("\n--- Valores Ausentes (%s) ---\n", NOMES_IMPUTACAO[p->imputacao]);
+    for (int c = 0; c < NUM_COLUNAS_NUMERICAS; c++) {
+        int campo = COLUNAS_NUMERICAS[c].campo;
+        if (contagem[campo] > 0) printf("  %-15s %d\n", COLUNAS_NUMERICAS[c].nome, contagem[campo]);
+    }
+    if (contagem[CAMPO_DATA] > 0) printf("  %-15s %d\n", "data", contagem[CAMPO_DATA]);
+    printf("Total imputado: %d\n", total);
+}
+
+static void etapaTratamento(Pipeline* p) {
+    tratarDados(&p->tabela);
+}
+
+static void etapaMomentos(Pipeline* p) {
+    calcularMomentos(&p->tabela, &p->momentos);
+}
+
+static void etapaRegressao(Pipeline* p) {
+    ajustarModelo(&p->momentos, &p->modelo);
+}
+
+static void etapaEstatisticas(Pipeline* p) {
+    analisarDados(&p->tabela, &p->momentos);
+}
+
+static void etapaDefasagem(Pipeline* p) {
+    analisarDefasagens(&p->tabela, p->maxDefasagem > 0 ? p->maxDefasagem : DEFASAGEM_PADRAO);
+}
+
+static void etapaPrevisao(Pipeline* p) {
+    preverConsumo(&p->tabela, &p->modelo);
+}
+
+static void etapaExportacao(Pipeline* p) {
+    exportarCSV("resultado_completo.csv", &p->tabela, &p->modelo);
+}
+
+static void etapaSimulacao(Pipeline* p) {
+    if (p->tabela.completo == NULL) {
+        // O simulador varre cada dia milhares de vezes: usa o layout completo
+        printf("\nSimulacao indisponivel com --compacto.\n");
+        return;
+    }
+    simularCenarios(p->tabela.completo, p->tabela.n, p->nThreads, "simulacao.csv");
+}
+
+#define BIT_ETAPA(e) (1u << (e))
+
+static const DefinicaoEtapa ETAPAS[NUM_ETAPAS] = {
+    [ETAPA_LEITURA]      = {"leitura",     "read",     0,                              etapaLeitura},
+    [ETAPA_IMPUTACAO]    = {"imputacao",   "impute",   BIT_ETAPA(ETAPA_LEITURA),       etapaImputacao},
+    [ETAPA_TRATAMENTO]   = {"tratamento",  "treat",    BIT_ETAPA(ETAPA_IMPUTACAO),     etapaTratamento},
+    [ETAPA_MOMENTOS]     = {"momentos",    "moments",  BIT_ETAPA(ETAPA_TRATAMENTO),    etapaMomentos},
+    [ETAPA_REGRESSAO]    = {"regressao",   "regress",  BIT_ETAPA(ETAPA_MOMENTOS),      etapaRegressao},
+    [ETAPA_ESTATISTICAS] = {"estatisticas","stats",    BIT_ETAPA(ETAPA_MOMENTOS),      etapaEstatisticas},
+    [ETAPA_DEFASAGEM]    = {"defasagem",   "lags",     BIT_ETAPA(ETAPA_TRATAMENTO),    etapaDefasagem},
+    [ETAPA_PREVISAO]     = {"previsao",    "forecast", BIT_ETAPA(ETAPA_REGRESSAO),     etapaPrevisao},
+    [ETAPA_EXPORTACAO]   = {"exportacao",  "export",   BIT_ETAPA(ETAPA_REGRESSAO),     etapaExportacao},
+    [ETAPA_SIMULACAO]    = {"simulacao",   "simulate", BIT_ETAPA(ETAPA_TRATAMENTO),    etapaSimulacao},
+};
+
+void executarEtapa(Pipeline* p, Etapa etapa) {
+    if (p->concluida[etapa] || p->erro) return;
+    for (int dep = 0; dep < NUM_ETAPAS; dep++) {
+        if (ETAPAS[etapa].dependencias & BIT_ETAPA(dep)) executarEtapa(p, (Etapa)dep);
+        if (p->erro) return;
+    }
+    ETAPAS[etapa].executar(p);
+    p->concluida[etapa] = 1;
+}
+
+// Converte "stats,forecast" em bits de etapas. Retorna 0 se algum nome for desconhecido.
+int selecionarEtapas(const char* lista, unsigned* selecao) {
+    char copia[MAX_LINHA];
+    strncpy(copia, lista, sizeof(copia) - 1);
+    copia[sizeof(copia) - 1] = '\0';
+
+    for (char* nome = strtok(copia, ","); nome != NULL; nome = strtok(NULL, ",")) {
+        int achou = 0;
+        for (int e = 0; e < NUM_ETAPAS; e++) {
+            if (strcmp(nome, ETAPAS[e].nome) == 0 || strcmp(nome, ETAPAS[e].apelido) == 0) {
+                *selecao |= BIT_ETAPA(e);
+                achou = 1;
+            }
+        }
+        if (!achou) {
+            printf("Etapa desconhecida: %s\n", nome);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// --- MAIN ---
+int main(int argc, char* argv[]) {
+    // Configura localidade para usar vírgula em números e acentos
+    setlocale(LC_ALL, ""); 
+    
+    static Pipeline pipeline;
+    const char* caminhoSocket = NULL;
+    char** arquivosFrota = NULL;
+    int nFrota = 0;
+    unsigned selecao = 0;
+    int apenas = 0;
+
+    pipeline.arquivo = "consumo.csv";
+
+    // Uso: ConsumoDeEnergia [--only etapas] [--servidor socket] [--simular] [--threads N]
+    //                       [--compacto] [--defasagem L] [--imputacao metodo] [arquivo.csv | -]
+    //                       [--frota arquivo1.csv arquivo2.csv ...]
+    //   "-"          lê de stdin em modo fluxo
+    //   arquivo/stdin compactado (gzip ou zstd) é detectado e descomprimido em paralelo;
+    //                só com -DCOM_ZLIB / -DCOM_ZSTD (ver "Compilar" no topo), senão é recusado
+    //   --only       roda só as etapas pedidas (e suas dependências), ex.: --only stats,forecast
+    //                etapas: imputacao|impute, tratamento, estatisticas|stats, defasagem|lags, previsao|forecast,
+    //                        exportacao|export, simulacao|simulate
+    //   --servidor   carrega uma vez e responde consultas no socket Unix
+    //   --simular    varre cenários de bateria/VE (exporta simulacao.csv)
+    //   --compacto   guarda os dias no layout compacto (RegistroCompacto) desde a leitura
+    //   --defasagem L  correlação cruzada consumo x variáveis para defasagens 0..L dias
+    //   --imputacao  preenchimento de células vazias: linear (padrão), ultimo ou mm3
+    //   --frota a.csv b.csv ...  compara os medidores entre si, dia a dia (últimos argumentos)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--servidor") == 0 && i + 1 < argc) caminhoSocket = argv[++i];
+        else if (strcmp(argv[i], "--frota") == 0) {
+            arquivosFrota = &argv[i + 1];
+            nFrota = argc - i - 1;
+            break;
+        }
+        else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            if (!selecionarEtapas(argv[++i], &selecao)) return 1;
+            apenas = 1;
+        }
+        else if (strcmp(argv[i], "--simular") == 0) { selecao |= BIT_ETAPA(ETAPA_SIMULACAO); apenas = 1; }
+        else if (strcmp(argv[i], "--compacto") == 0) pipeline.compacto = 1;
+        else if (strcmp(argv[i], "--defasagem") == 0 && i + 1 < argc) {
+            pipeline.maxDefasagem = atoi(argv[++i]);
+            if (pipeline.maxDefasagem > 0) selecao |= BIT_ETAPA(ETAPA_DEFASAGEM);
+        }
+        else if (strcmp(argv[i], "--imputacao") == 0 && i + 1 < argc) {
+            const char* metodo = argv[++i];
+            int m = 0;
+            while (m < NUM_METODOS_IMPUTACAO && strcmp(metodo, NOMES_IMPUTACAO[m]) != 0) m++;
+            if (m == NUM_METODOS_IMPUTACAO) {
+                printf("Metodo de imputacao desconhecido: %s\n", metodo);
+                return 1;
+            }
+            pipeline.imputacao = (MetodoImputacao)m;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) pipeline.nThreads = atoi(argv[++i]);
+        else pipeline.arquivo = argv[i];
+    }
+
+    if (nFrota > 0) {
+        return analisarFrota(arquivosFrota, nFrota, pipeline.nThreads);
+    }
+
+    if (caminhoSocket != NULL) {
+        return executarServidor(pipeline.arquivo, caminhoSocket);
+    }
+
+    if (strcmp(pipeline.arquivo, "-") == 0) {
+        fprintf(stderr, "Lendo dados de stdin (modo fluxo)...\n");
+        if (processarFluxo(stdin) <= 0) {
+            fprintf(stderr, "Erro: Nenhum dado valido recebido.\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    // Padrão: análise estatística e previsão
+    if (!apenas) selecao |= BIT_ETAPA(ETAPA_ESTATISTICAS) | BIT_ETAPA(ETAPA_PREVISAO);
+
+    for (int e = 0; e < NUM_ETAPAS; e++) {
+        if (selecao & BIT_ETAPA(e)) executarEtapa(&pipeline, (Etapa)e);
+    }
+
+    free(pipeline.tabela.completo);
+    free(pipeline.tabela.compacto);
+    return pipeline.erro;
+}
@@ -34,12 +34,18 @@ typedef struct {
     int ehOutlier;
 } RegistroEnergia;
 
+// Coeficientes da regressão Consumo ~ Irradiância (calculados uma vez)
+typedef struct {
+    double b0, b1;
+} ModeloLinear;
+
 // --- Protótipos ---
 int lerCSV(const char* nomeArquivo, RegistroEnergia dados[], int maxRegistros);
 void tratarDados(RegistroEnergia dados[], int n);
 void analisarDados(RegistroEnergia dados[], int n);
-void preverConsumo(RegistroEnergia dados[], int n);
-void exportarCSV(const char* nomeArquivo, RegistroEnergia dados[], int n);
+void ajustarModelo(RegistroEnergia dados[], int n, ModeloLinear* modelo);
+void preverConsumo(RegistroEnergia dados[], int n, const ModeloLinear* modelo);
+void exportarCSV(const char* nomeArquivo, RegistroEnergia dados[], int n, const ModeloLinear* modelo);
 
 // ============================================================================
 // FUNÇÃO PRINCIPAL
@@ -74,10 +80,12 @@ int main() {
     // 4. Tratamento e Análise
     tratarDados(dados, n);
     analisarDados(dados, n);
-    preverConsumo(dados, n);
+    ModeloLinear modelo;
+    ajustarModelo(dados, n, &modelo);
+    preverConsumo(dados, n, &modelo);
 
     // 5. Exportação Final
-    exportarCSV(arquivoSaida, dados, n);
+    exportarCSV(arquivoSaida, dados, n, &modelo);
 
     printf("\n--- FIM ---\n");
     return 0;
@@ -232,15 +240,8 @@ void analisarDados(RegistroEnergia dados[], int n) {
         cUtil?sUtil/cUtil:0, cFDS?sFDS/cFDS:0);
 }
 
-void preverConsumo(RegistroEnergia dados[], int n) {
-    if(n<3) return;
-    printf("\n--- Previsao Futura (Dia %d) ---\n", n+1);
-    
-    // MM3
-    double mm3 = (dados[n-1].consumo + dados[n-2].consumo + dados[n-3].consumo)/3.0;
-    printf("Previsao MM3: %.2f kWh\n", mm3);
-
-    // Regressão Simples (Apenas cálculo dos coeficientes para exibição)
+// Regressão Simples: calculada uma vez e usada na previsão e na exportação
+void ajustarModelo(RegistroEnergia dados[], int n, ModeloLinear* modelo) {
     double sX=0, sY=0, sXY=0, sX2=0;
     for(int i=0; i<n; i++) {
         double x = dados[i].irradiancia;
@@ -248,27 +249,28 @@ void preverConsumo(RegistroEnergia dados[], int n) {
         sX+=x; sY+=y; sXY+=x*y; sX2+=x*x;
     }
     double mX = sX/n; double mY = sY/n;
-    double b1 = (sXY - n*mX*mY) / (sX2 - n*mX*mX);
-    double b0 = mY - b1*mX;
+    modelo->b1 = (sXY - n*mX*mY) / (sX2 - n*mX*mX);
+    modelo->b0 = mY - modelo->b1*mX;
+}
+
+void preverConsumo(RegistroEnergia dados[], int n, const ModeloLinear* modelo) {
+    if(n<3) return;
+    printf("\n--- Previsao Futura (Dia %d) ---\n", n+1);
     
-    printf("Modelo Linear: Consumo = %.2f + (%.2f * Irradiancia)\n", b0, b1);
+    // MM3
+    double mm3 = (dados[n-1].consumo + dados[n-2].consumo + dados[n-3].consumo)/3.0;
+    printf("Previsao MM3: %.2f kWh\n", mm3);
+
+    printf("Modelo Linear: Consumo = %.2f + (%.2f * Irradiancia)\n", modelo->b0, modelo->b1);
     printf("Nota: Para prever o dia %d via Regressao, precisamos da Irradiancia prevista.\n", n+1);
 }
 
-void exportarCSV(const char* nomeArquivo, RegistroEnergia dados[], int n) {
+void exportarCSV(const char* nomeArquivo, RegistroEnergia dados[], int n, const ModeloLinear* modelo) {
     FILE* f = fopen(nomeArquivo, "w");
     if (!f) { printf("Erro ao criar arquivo de exportacao.\n"); return; }
 
-    // Recalcular coeficientes de regressão para usar no loop
-    double sX=0, sY=0, sXY=0, sX2=0;
-    for(int i=0; i<n; i++) {
-        double x = dados[i].irradiancia;
-        double y = dados[i].consumo;
-        sX+=x; sY+=y; sXY+=x*y; sX2+=x*x;
-    }
-    double mX = sX/n; double mY = sY/n;
-    double b1 = (sXY - n*mX*mY) / (sX2 - n*mX*mX);
-    double b0 = mY - b1*mX;
+    // Coeficientes já calculados em ajustarModelo
+    double b0 = modelo->b0, b1 = modelo->b1;
 
     // Cabeçalho
     fprintf(f, "Dia;Data;ConsumoOriginal;ConsumoTratado;ConsumoLiquido;GeraçãoFV;ZScore;EhOutlier;Prev_MM3;Prev_Linear\n");